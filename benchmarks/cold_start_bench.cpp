@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "discovery/discovery_peer.h"
+#include "discovery/discovery_peer_group.h"
+
+// Measures how long a freshly started discoverer takes to see every peer of
+// an established population on loopback, with and without kQuery. Without
+// queries the discoverer has to wait for each peer's next periodic
+// announcement. The population is run both as members of one PeerGroup and
+// as standalone peers that can be discovered but not discover, the way a
+// discover-only client finds servers (see examples/main.cpp).
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint16_t kPort = 23491;
+constexpr uint32_t kApplicationId = 0xc01d;
+constexpr int64_t kSendTimeoutMs = 2000;
+constexpr int kTrials = 5;
+
+discovery::PeerParameters MakeParameters() {
+  discovery::PeerParameters parameters;
+  parameters.set_port(kPort);
+  parameters.set_application_id(kApplicationId);
+  parameters.set_send_timeout_ms(kSendTimeoutMs);
+  parameters.set_discovered_peer_ttl_ms(kSendTimeoutMs * 3);
+  parameters.set_send_jitter(0.5);
+  return parameters;
+}
+
+// Returns the milliseconds until a new discoverer sees population_size
+// peers, or a negative value if it does not within two send intervals.
+double TimeToFullView(size_t population_size, bool use_queries) {
+  discovery::Peer discoverer;
+  discovery::PeerParameters parameters = MakeParameters();
+  parameters.set_can_discover(true);
+  parameters.set_use_queries(use_queries);
+
+  auto start = Clock::now();
+  if (!discoverer.Start(parameters, "discoverer")) {
+    return -1;
+  }
+  auto deadline = start + std::chrono::milliseconds(kSendTimeoutMs * 2);
+  while (Clock::now() < deadline) {
+    if (discoverer.Snapshot()->size() >= population_size) {
+      return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  return -1;
+}
+
+// Starts population_size peers, in a PeerGroup or standalone, and prints
+// the time to full view with and without queries. Returns false on failure.
+bool MeasurePopulation(bool in_group, size_t population_size) {
+  discovery::PeerGroup group;
+  if (in_group && !group.Start(MakeParameters())) {
+    std::cerr << "failed to start the population" << std::endl;
+    return false;
+  }
+  std::vector<std::unique_ptr<discovery::Peer>> population;
+  for (size_t i = 0; i < population_size; ++i) {
+    discovery::PeerParameters parameters = MakeParameters();
+    parameters.set_can_be_discovered(true);
+    parameters.set_use_queries(true);
+    population.push_back(std::make_unique<discovery::Peer>());
+    std::string user_data = "peer-" + std::to_string(i);
+    bool started = in_group ? population.back()->Start(group, parameters, user_data)
+                            : population.back()->Start(parameters, user_data);
+    if (!started) {
+      std::cerr << "failed to start the population" << std::endl;
+      return false;
+    }
+  }
+  // Let the initial announcements go by so the discoverer depends on the
+  // periodic ones.
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  for (bool use_queries : {true, false}) {
+    std::vector<double> times;
+    for (int trial = 0; trial < kTrials; ++trial) {
+      double ms = TimeToFullView(population_size, use_queries);
+      if (ms < 0) {
+        std::cerr << "discoverer did not see all " << population_size << " peers" << std::endl;
+        return false;
+      }
+      times.push_back(ms);
+      // Stay clear of min_resend_interval, which would hold back the
+      // responses to the next trial's query.
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    std::sort(times.begin(), times.end());
+    std::cout << std::setw(12) << (in_group ? "group" : "standalone") << std::setw(8) << population_size
+              << std::setw(10) << (use_queries ? "on" : "off") << std::setw(18) << std::fixed << std::setprecision(1)
+              << times[times.size() / 2] << std::setw(14) << times.back() << std::endl;
+  }
+
+  for (auto& peer : population) {
+    peer->StopAndWaitForThreads();
+  }
+  group.StopAndWaitForThreads();
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  const size_t kPopulationSizes[] = {10, 100};
+
+  std::cout << std::setw(12) << "population" << std::setw(8) << "peers" << std::setw(10) << "queries"
+            << std::setw(18) << "median ms" << std::setw(14) << "max ms" << std::endl;
+
+  for (bool in_group : {true, false}) {
+    for (size_t population_size : kPopulationSizes) {
+      if (!MeasurePopulation(in_group, population_size)) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
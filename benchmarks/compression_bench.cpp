@@ -0,0 +1,111 @@
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "discovery/discovery_protocol.h"
+#include "discovery_compression.h"
+
+// Measures bytes on the wire and CPU per packet for announcements carrying
+// JSON capability descriptors, sent plain and compressed.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::string MakeDescriptor(size_t size) {
+  std::string json = "[";
+  for (int i = 0; json.size() < size; ++i) {
+    json += "{\"service\":\"svc-" + std::to_string(i) + "\",\"protocol\":\"grpc\",\"port\":" +
+            std::to_string(8000 + i) + ",\"version\":\"1." + std::to_string(i % 7) + ".0\",\"healthy\":true},";
+  }
+  json.resize(size - 1);
+  json += "]";
+  return json;
+}
+
+template <typename Func>
+double MeasureNsPerOp(size_t iterations, Func func) {
+  auto start = Clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    func();
+  }
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(iterations);
+}
+
+}  // namespace
+
+int main() {
+  const size_t kPayloadSizes[] = {256, 1024, 2048, 4096};
+  const size_t kIterations = 20000;
+
+  std::cout << std::setw(10) << "payload" << std::setw(12) << "plain B" << std::setw(14) << "compressed B"
+            << std::setw(16) << "plain ser ns" << std::setw(16) << "comp ser ns" << std::setw(18) << "plain parse ns"
+            << std::setw(18) << "comp parse ns" << std::endl;
+
+  for (size_t payload_size : kPayloadSizes) {
+    std::string user_data = MakeDescriptor(payload_size);
+
+    discovery::Packet packet;
+    packet.set_flags(discovery::kPacketFlagExtensionsAware);
+    packet.set_application_id(1001);
+    packet.set_peer_id(42);
+    packet.set_user_data(user_data);
+
+    std::string plain;
+    packet.Serialize(plain);
+
+    std::string compressed_payload;
+    std::string compressed;
+    bool compressible = discovery::impl::CompressPayload(user_data, &compressed_payload);
+    discovery::Packet compressed_packet = packet;
+    if (compressible) {
+      compressed_packet.set_flags(discovery::kPacketFlagExtensionsAware | discovery::kPacketFlagCompressed);
+      compressed_packet.set_user_data(compressed_payload);
+    }
+    compressed_packet.Serialize(compressed);
+
+    // The compressed packet must round-trip to the original user data.
+    discovery::PacketView view;
+    std::string scratch;
+    if (!view.Parse(compressed.data(), compressed.size()) || !view.Decompress(&scratch) ||
+        view.user_data() != user_data) {
+      std::cerr << "round trip failed at payload " << payload_size << std::endl;
+      return 1;
+    }
+
+    std::string buffer;
+    double plain_serialize_ns = MeasureNsPerOp(kIterations, [&]() {
+      buffer.clear();
+      packet.Serialize(buffer);
+    });
+    double compressed_serialize_ns = MeasureNsPerOp(kIterations, [&]() {
+      buffer.clear();
+      discovery::impl::CompressPayload(user_data, &compressed_payload);
+      compressed_packet.SwapUserData(compressed_payload);
+      compressed_packet.Serialize(buffer);
+      compressed_packet.SwapUserData(compressed_payload);
+    });
+    size_t checksum = 0;
+    double plain_parse_ns = MeasureNsPerOp(kIterations, [&]() {
+      view.Parse(plain.data(), plain.size());
+      checksum += view.user_data().size();
+    });
+    double compressed_parse_ns = MeasureNsPerOp(kIterations, [&]() {
+      view.Parse(compressed.data(), compressed.size());
+      view.Decompress(&scratch);
+      checksum += view.user_data().size();
+    });
+    // Keep the measured loops from being optimized away.
+    volatile size_t sink = checksum;
+    (void)sink;
+
+    std::cout << std::setw(10) << payload_size << std::setw(12) << plain.size() << std::setw(14) << compressed.size()
+              << std::fixed << std::setprecision(1) << std::setw(16) << plain_serialize_ns << std::setw(16)
+              << compressed_serialize_ns << std::setw(18) << plain_parse_ns << std::setw(18) << compressed_parse_ns
+              << std::endl;
+  }
+
+  return 0;
+}
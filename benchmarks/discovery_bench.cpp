@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "discovery/discovery_peer.h"
+#include "discovery/discovery_protocol.h"
+#include "discovery_driven_peer.h"
+#include "discovery_peer_table.h"
+
+#if !defined(_WIN32)
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Self-contained benchmarks of the hot paths applications depend on, meant
+// to be tracked across releases. Every result is written to stdout as one
+// JSON object per line:
+//
+//   {"benchmark":"packet_parse","payload_bytes":64,"iterations":...,"ns_per_op":...}
+//
+// Usage: discovery_bench [filter]
+//
+// runs only the groups whose name contains filter: packet_codec,
+// receive_apply (which also reports receive_join), expiry_sweep and
+// list_discovered_under_load.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Mode = discovery::PeerParameters::SamePeerMode;
+
+// Keeps the optimizer from discarding benchmarked work.
+std::atomic<uint64_t> g_sink{0};
+
+// One result line: the benchmark name, its parameters and measurements.
+class Result {
+ public:
+  explicit Result(const std::string& name) { out_ << "{\"benchmark\":\"" << name << "\""; }
+
+  Result& Add(const char* key, double value) {
+    out_ << ",\"" << key << "\":" << value;
+    return *this;
+  }
+
+  Result& Add(const char* key, uint64_t value) {
+    out_ << ",\"" << key << "\":" << value;
+    return *this;
+  }
+
+  void Emit() { std::cout << out_.str() << "}" << std::endl; }
+
+ private:
+  std::ostringstream out_;
+};
+
+template <typename Func>
+double MeasureNs(Func func) {
+  auto start = Clock::now();
+  func();
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+discovery::IpPort AddressOf(size_t index) {
+  // 10.x.y.z with a per-peer ephemeral port.
+  return discovery::IpPort(0x0a000000u | static_cast<uint32_t>(index & 0xffffff),
+                           static_cast<uint16_t>(40000 + (index % 20000)));
+}
+
+discovery::Packet MakePacket(size_t payload_bytes) {
+  discovery::Packet packet;
+  packet.set_packet_type(discovery::kPacketIAmHere);
+  packet.set_flags(discovery::kPacketFlagExtensionsAware);
+  packet.set_application_id(0xbe4c);
+  packet.set_peer_id(7);
+  packet.set_snapshot_index(1);
+  std::string user_data(payload_bytes, '\0');
+  for (size_t i = 0; i < payload_bytes; ++i) {
+    user_data[i] = static_cast<char>('a' + i % 26);
+  }
+  packet.set_user_data(user_data);
+  return packet;
+}
+
+void BenchPacketCodec() {
+  const size_t kPayloadSizes[] = {0, 64, 512, 4096};
+  constexpr uint64_t kIterations = 1000000;
+
+  for (size_t payload_bytes : kPayloadSizes) {
+    discovery::Packet packet = MakePacket(payload_bytes);
+    std::string buffer;
+
+    double serialize_ns = MeasureNs([&]() {
+      for (uint64_t i = 0; i < kIterations; ++i) {
+        packet.set_snapshot_index(i);
+        packet.Serialize(buffer);
+        g_sink += buffer.size();
+      }
+    });
+    Result("packet_serialize")
+        .Add("payload_bytes", static_cast<uint64_t>(payload_bytes))
+        .Add("iterations", kIterations)
+        .Add("ns_per_op", serialize_ns / kIterations)
+        .Emit();
+
+    discovery::Packet parsed;
+    double parse_ns = MeasureNs([&]() {
+      for (uint64_t i = 0; i < kIterations; ++i) {
+        g_sink += parsed.Parse(buffer) ? parsed.user_data().size() : 0;
+      }
+    });
+    Result("packet_parse")
+        .Add("payload_bytes", static_cast<uint64_t>(payload_bytes))
+        .Add("iterations", kIterations)
+        .Add("ns_per_op", parse_ns / kIterations)
+        .Emit();
+
+    discovery::PacketView view;
+    double view_ns = MeasureNs([&]() {
+      for (uint64_t i = 0; i < kIterations; ++i) {
+        g_sink += view.Parse(buffer.data(), buffer.size()) ? view.user_data().size() : 0;
+      }
+    });
+    Result("packet_view_parse")
+        .Add("payload_bytes", static_cast<uint64_t>(payload_bytes))
+        .Add("iterations", kIterations)
+        .Add("ns_per_op", view_ns / kIterations)
+        .Emit();
+  }
+}
+
+// Discards everything a driven peer sends.
+class NullTransport : public discovery::impl::Transport {
+ public:
+  size_t Send(const std::string&) override { return 0; }
+  size_t destination_count() const override { return 1; }
+};
+
+// Hands announcements to a discovering peer that knows peer_count peers,
+// through the same Receive() path the receiving thread takes for a peer
+// whose user data is unchanged: prefilter and parse in place, take the
+// peer mutex, locate the sender, compare the payload, refresh the entry
+// and check whether the snapshot has to be republished.
+//
+// Every peer joins through Receive() too, and each join republishes the
+// snapshot, so setting up is quadratic in peer_count; 10000 peers is the
+// largest table measured.
+void BenchReceiveApply() {
+  const size_t kPeerCounts[] = {10, 100, 1000, 10000, 100000};
+  constexpr uint64_t kIterations = 2000000;
+  constexpr int64_t kStartTimeMs = 1000000;
+  // Announcements applied per batch while the table is populated; every
+  // batch publishes one snapshot of the table.
+  constexpr size_t kJoinBatchSize = 1024;
+
+  discovery::Packet packet = MakePacket(64);
+  std::string datagram;
+  packet.Serialize(datagram);
+
+  discovery::PeerParameters parameters;
+  parameters.set_application_id(packet.application_id());
+  parameters.set_can_discover(true);
+  parameters.set_can_be_discovered(false);
+  parameters.set_discovered_peer_ttl_ms(3600000);
+
+  using Datagram = discovery::impl::DrivenPeer::Datagram;
+  std::vector<Datagram> batch;
+  batch.reserve(kJoinBatchSize);
+
+  for (size_t peer_count : kPeerCounts) {
+    auto peer = discovery::impl::StartDrivenPeer(parameters, std::string(), std::make_unique<NullTransport>(), 1);
+    double join_ns = MeasureNs([&]() {
+      for (size_t first = 0; first < peer_count; first += kJoinBatchSize) {
+        batch.clear();
+        for (size_t i = first; i < std::min(first + kJoinBatchSize, peer_count); ++i) {
+          batch.push_back(Datagram{AddressOf(i), datagram.data(), datagram.size()});
+        }
+        peer->Receive(kStartTimeMs, batch.data(), batch.size());
+      }
+    });
+    Result("receive_join")
+        .Add("peers", static_cast<uint64_t>(peer_count))
+        .Add("batch", static_cast<uint64_t>(kJoinBatchSize))
+        .Add("ns_per_peer", join_ns / peer_count)
+        .Emit();
+
+    uint64_t index = 0;
+    double ns = MeasureNs([&]() {
+      for (uint64_t i = 0; i < kIterations; ++i) {
+        // Visit the peers in a scattered order, each announcement newer than
+        // the last one of its sender.
+        index = (index + 7919) % peer_count;
+        discovery::impl::StoreBigEndian(&datagram[discovery::impl::kSnapshotIndexOffset], i + 2);
+        peer->Receive(kStartTimeMs + static_cast<int64_t>(i / 1000), AddressOf(index), datagram.data(),
+                      datagram.size());
+      }
+    });
+    g_sink += peer->Snapshot()->size();
+    peer->Exit();
+    Result("receive_apply")
+        .Add("peers", static_cast<uint64_t>(peer_count))
+        .Add("iterations", kIterations)
+        .Add("ns_per_op", ns / kIterations)
+        .Emit();
+    discovery::impl::StoreBigEndian(&datagram[discovery::impl::kSnapshotIndexOffset], uint64_t{1});
+  }
+}
+
+// Times EraseExpired() on a table of peer_count peers in three states:
+// nothing due, everything due but refreshed in the meantime (the heap
+// nodes are rescheduled), and a tenth of the peers expired.
+void BenchExpirySweep() {
+  const size_t kPeerCounts[] = {100, 1000, 10000, 100000};
+  constexpr int64_t kTtlMs = 1000;
+
+  for (size_t peer_count : kPeerCounts) {
+    discovery::impl::PeerTable table(Mode::kIpAndPort, kTtlMs);
+    for (size_t i = 0; i < peer_count; ++i) {
+      table.Insert(AddressOf(i), 0);
+    }
+
+    double idle_ns = MeasureNs([&]() { g_sink += table.EraseExpired(kTtlMs / 2); });
+
+    for (size_t i = 0; i < peer_count; ++i) {
+      table.Find(AddressOf(i))->set_last_updated(kTtlMs);
+    }
+    double refresh_ns = MeasureNs([&]() { g_sink += table.EraseExpired(kTtlMs + 1); });
+
+    for (size_t i = 0; i < peer_count; ++i) {
+      if (i % 10 != 0) {
+        table.Find(AddressOf(i))->set_last_updated(3 * kTtlMs);
+      }
+    }
+    size_t expired = 0;
+    double expire_ns = MeasureNs([&]() { expired = table.EraseExpired(3 * kTtlMs); });
+
+    Result("expiry_sweep")
+        .Add("peers", static_cast<uint64_t>(peer_count))
+        .Add("idle_ns", idle_ns)
+        .Add("rescheduled_ns", refresh_ns)
+        .Add("expired_ns", expire_ns)
+        .Add("expired", static_cast<uint64_t>(expired))
+        .Emit();
+  }
+}
+
+#if !defined(_WIN32)
+
+// Floods a listening Peer over loopback with announcements from
+// sender_count sockets while the main thread reads the discovered list.
+void BenchListUnderLoad() {
+  const size_t kSenderCounts[] = {100, 1000};
+  constexpr uint16_t kPort = 23511;
+  constexpr uint32_t kApplicationId = 0xbe4c;
+  constexpr auto kDuration = std::chrono::seconds(1);
+
+  for (size_t sender_count : kSenderCounts) {
+    discovery::PeerParameters parameters;
+    parameters.set_port(kPort);
+    parameters.set_application_id(kApplicationId);
+    parameters.set_can_discover(true);
+    parameters.set_discovered_peer_ttl_ms(60000);
+    discovery::Peer listener;
+    if (!listener.Start(parameters, "listener")) {
+      return;
+    }
+
+    std::vector<int> sockets;
+    std::vector<std::string> datagrams;
+    for (size_t i = 0; i < sender_count; ++i) {
+      int sock = socket(AF_INET, SOCK_DGRAM, 0);
+      if (sock < 0) {
+        break;
+      }
+      sockets.push_back(sock);
+      discovery::Packet packet = MakePacket(64);
+      packet.set_application_id(kApplicationId);
+      packet.set_peer_id(static_cast<uint32_t>(i + 1));
+      datagrams.emplace_back();
+      packet.Serialize(datagrams.back());
+    }
+
+    sockaddr_in to{};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(kPort);
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> sent{0};
+    std::thread flood([&]() {
+      while (!stop) {
+        for (size_t i = 0; i < sockets.size(); ++i) {
+          if (sendto(sockets[i], datagrams[i].data(), datagrams[i].size(), 0, reinterpret_cast<sockaddr*>(&to),
+                     sizeof(to)) > 0) {
+            ++sent;
+          }
+        }
+      }
+    });
+
+    // Wait until the whole population is known, then measure.
+    auto deadline = Clock::now() + std::chrono::seconds(5);
+    while (listener.Snapshot()->size() < sockets.size() && Clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    uint64_t sent_before = sent;
+    uint64_t list_calls = 0;
+    uint64_t list_size = 0;
+    auto start = Clock::now();
+    while (Clock::now() - start < kDuration) {
+      list_size = listener.ListDiscovered().size();
+      ++list_calls;
+    }
+    double list_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / list_calls;
+
+    uint64_t snapshot_calls = 0;
+    start = Clock::now();
+    while (Clock::now() - start < kDuration) {
+      g_sink += listener.Snapshot()->size();
+      ++snapshot_calls;
+    }
+    double snapshot_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / snapshot_calls;
+    double flood_seconds = std::chrono::duration<double>(2 * kDuration).count();
+    uint64_t flood_packets = sent - sent_before;
+
+    stop = true;
+    flood.join();
+    for (int sock : sockets) {
+      close(sock);
+    }
+    discovery::PeerStats stats = listener.GetStats();
+    listener.StopAndWaitForThreads();
+
+    Result("list_discovered_under_load")
+        .Add("peers", static_cast<uint64_t>(list_size))
+        .Add("flood_packets_per_s", static_cast<double>(flood_packets) / flood_seconds)
+        .Add("list_ns_per_op", list_ns)
+        .Add("snapshot_ns_per_op", snapshot_ns)
+        .Add("lock_hold_p99_us", stats.lock_hold_time().QuantileUpperBoundUs(0.99))
+        .Emit();
+  }
+}
+
+#endif  // !_WIN32
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string filter = argc > 1 ? argv[1] : "";
+  auto selected = [&filter](const char* name) { return filter.empty() || std::strstr(name, filter.c_str()); };
+
+  if (selected("packet_codec")) {
+    BenchPacketCodec();
+  }
+  if (selected("receive_apply")) {
+    BenchReceiveApply();
+  }
+  if (selected("expiry_sweep")) {
+    BenchExpirySweep();
+  }
+#if !defined(_WIN32)
+  if (selected("list_discovered_under_load")) {
+    BenchListUnderLoad();
+  }
+#endif
+  return 0;
+}
@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "discovery/discovery_peer.h"
+#include "discovery/discovery_protocol.h"
+
+#if !defined(_WIN32)
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Load generator for the receive path: synthesizes announcements from many
+// fake peers, each with its own peer_id and source port, and sends them at
+// a listening Peer over loopback. Reports how many the Peer parsed per
+// second, how many were lost on the way and how long the Peer took to see
+// the whole population.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint16_t kPort = 23521;
+constexpr uint32_t kApplicationId = 0xf100d;
+
+void Usage(char* argv[]) {
+  std::cout << "Usage: " << argv[0] << " [peers [payload_bytes [rate [seconds [threads [readers]]]]]]" << std::endl;
+  std::cout << "  peers - number of fake peers, one socket each (default 1000)" << std::endl;
+  std::cout << "  payload_bytes - user data size of every announcement (default 64)" << std::endl;
+  std::cout << "  rate - total packets per second, 0 for as fast as possible (default 0)" << std::endl;
+  std::cout << "  seconds - duration of the flood (default 3)" << std::endl;
+  std::cout << "  threads - number of sending threads (default 2)" << std::endl;
+  std::cout << "  readers - threads calling ListDiscovered() in a loop meanwhile (default 0)" << std::endl;
+}
+
+#if defined(__linux__)
+// Returns the system-wide count of UDP datagrams the kernel dropped because
+// a receive buffer was full, or -1 if it is not available.
+int64_t KernelReceiveBufferErrors() {
+  std::ifstream snmp("/proc/net/snmp");
+  std::string header;
+  std::string line;
+  while (std::getline(snmp, line)) {
+    if (line.compare(0, 4, "Udp:") != 0) {
+      continue;
+    }
+    if (header.empty()) {
+      header = line;
+      continue;
+    }
+    std::istringstream names(header);
+    std::istringstream values(line);
+    std::string name;
+    std::string value;
+    while (names >> name && values >> value) {
+      if (name == "RcvbufErrors") {
+        return std::strtoll(value.c_str(), nullptr, 10);
+      }
+    }
+  }
+  return -1;
+}
+#else
+int64_t KernelReceiveBufferErrors() { return -1; }
+#endif
+
+}  // namespace
+
+#if defined(_WIN32)
+
+int main() {
+  std::cerr << "discovery_flood is not supported on this platform" << std::endl;
+  return 1;
+}
+
+#else
+
+int main(int argc, char* argv[]) {
+  if (argc > 1 && std::string(argv[1]) == "--help") {
+    Usage(argv);
+    return 0;
+  }
+  size_t peer_count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+  size_t payload_bytes = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 64;
+  double rate = argc > 3 ? std::atof(argv[3]) : 0;
+  double seconds = argc > 4 ? std::atof(argv[4]) : 3;
+  size_t thread_count = argc > 5 ? std::strtoul(argv[5], nullptr, 10) : 2;
+  size_t reader_count = argc > 6 ? std::strtoul(argv[6], nullptr, 10) : 0;
+  if (peer_count == 0 || seconds <= 0 || thread_count == 0) {
+    Usage(argv);
+    return 1;
+  }
+  thread_count = std::min(thread_count, peer_count);
+
+  discovery::PeerParameters parameters;
+  parameters.set_port(kPort);
+  parameters.set_application_id(kApplicationId);
+  parameters.set_can_discover(true);
+  parameters.set_discovered_peer_ttl_ms(60000);
+  discovery::Peer listener;
+  if (!listener.Start(parameters, "listener")) {
+    std::cerr << "failed to start the listening peer" << std::endl;
+    return 1;
+  }
+
+  std::vector<int> sockets;
+  std::vector<std::string> datagrams;
+  std::string user_data(payload_bytes, '\0');
+  for (size_t i = 0; i < payload_bytes; ++i) {
+    user_data[i] = static_cast<char>('a' + i % 26);
+  }
+  for (size_t i = 0; i < peer_count; ++i) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+      std::cerr << "could only open " << sockets.size() << " sockets" << std::endl;
+      break;
+    }
+    sockets.push_back(sock);
+    discovery::Packet packet;
+    packet.set_packet_type(discovery::kPacketIAmHere);
+    packet.set_flags(discovery::kPacketFlagExtensionsAware);
+    packet.set_application_id(kApplicationId);
+    packet.set_peer_id(static_cast<uint32_t>(i + 1));
+    packet.set_snapshot_index(1);
+    packet.set_user_data(user_data);
+    datagrams.emplace_back();
+    if (!packet.Serialize(datagrams.back())) {
+      std::cerr << "payload_bytes is too large for one packet" << std::endl;
+      return 1;
+    }
+  }
+  peer_count = sockets.size();
+
+  sockaddr_in to{};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(kPort);
+  to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> sent{0};
+  std::atomic<uint64_t> send_failures{0};
+  const discovery::PeerStats stats_before = listener.GetStats();
+  const int64_t kernel_drops_before = KernelReceiveBufferErrors();
+  const auto start = Clock::now();
+
+  // Every thread sends for its own slice of the fake peers, round-robin, at
+  // rate / thread_count packets per second.
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&, t]() {
+      const size_t first = peer_count * t / thread_count;
+      const size_t last = peer_count * (t + 1) / thread_count;
+      const double thread_rate = rate / thread_count;
+      uint64_t thread_sent = 0;
+      size_t i = first;
+      while (!stop) {
+        if (thread_rate > 0) {
+          auto due = start + std::chrono::duration_cast<Clock::duration>(
+                                 std::chrono::duration<double>(thread_sent / thread_rate));
+          if (Clock::now() < due) {
+            std::this_thread::sleep_until(std::min(due, Clock::now() + std::chrono::milliseconds(1)));
+            continue;
+          }
+        }
+        if (sendto(sockets[i], datagrams[i].data(), datagrams[i].size(), 0, reinterpret_cast<sockaddr*>(&to),
+                   sizeof(to)) > 0) {
+          ++sent;
+        } else {
+          ++send_failures;
+        }
+        ++thread_sent;
+        if (++i == last) {
+          i = first;
+        }
+      }
+    });
+  }
+
+  // Readers contend with the receiving thread for the table.
+  std::atomic<uint64_t> list_calls{0};
+  for (size_t t = 0; t < reader_count; ++t) {
+    threads.emplace_back([&]() {
+      while (!stop) {
+        if (!listener.ListDiscovered().empty()) {
+          ++list_calls;
+        }
+      }
+    });
+  }
+
+  // Time until the Peer has seen every fake peer at least once.
+  double convergence_ms = -1;
+  const auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+  while (Clock::now() < deadline) {
+    if (convergence_ms < 0 && listener.Snapshot()->size() >= peer_count) {
+      convergence_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  stop = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+  // Give the receiving thread a moment to drain the socket buffer.
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  const discovery::PeerStats stats = listener.GetStats();
+  const int64_t kernel_drops_after = KernelReceiveBufferErrors();
+  for (int sock : sockets) {
+    close(sock);
+  }
+  listener.StopAndWaitForThreads();
+
+  const uint64_t received = stats.packets_received() - stats_before.packets_received();
+  const uint64_t accepted = stats.packets_accepted() - stats_before.packets_accepted();
+  const uint64_t total_sent = sent;
+  const uint64_t lost = total_sent > received ? total_sent - received : 0;
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "fake peers:          " << peer_count << std::endl;
+  std::cout << "payload bytes:       " << payload_bytes << " (" << datagrams.front().size() << " per datagram)"
+            << std::endl;
+  std::cout << "sent:                " << total_sent << " (" << total_sent / elapsed << "/s, " << send_failures
+            << " failed)" << std::endl;
+  std::cout << "parsed:              " << accepted << " (" << accepted / elapsed << "/s)" << std::endl;
+  std::cout << "dropped:             " << lost << " (" << (total_sent ? 100.0 * lost / total_sent : 0) << "%)"
+            << std::endl;
+  if (kernel_drops_before >= 0 && kernel_drops_after >= 0) {
+    std::cout << "kernel buffer drops: " << kernel_drops_after - kernel_drops_before << " (system-wide)"
+              << std::endl;
+  }
+  std::cout << "queue overflows:     " << stats.receive_queue_overflows() << " (max depth "
+            << stats.receive_queue_depth_max() << ")" << std::endl;
+  if (convergence_ms >= 0) {
+    std::cout << "convergence:         " << convergence_ms << " ms to see " << peer_count << " peers" << std::endl;
+  } else {
+    std::cout << "convergence:         not reached, " << stats.table_size() << " of " << peer_count
+              << " peers seen" << std::endl;
+  }
+  if (reader_count > 0) {
+    std::cout << "ListDiscovered():    " << list_calls / elapsed << "/s from " << reader_count << " readers"
+              << std::endl;
+  }
+  std::cout << "receive batch p99:   " << stats.receive_batch_time().QuantileUpperBoundUs(0.99) << " us" << std::endl;
+  std::cout << "lock hold p99:       " << stats.lock_hold_time().QuantileUpperBoundUs(0.99) << " us" << std::endl;
+  return 0;
+}
+
+#endif  // _WIN32
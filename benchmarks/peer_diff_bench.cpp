@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <string>
+
+#include "discovery/discovery_peer.h"
+
+// Compares the sort-based Same()/Diff() against the nested find_if scan that
+// Same() used to perform, on two lists that differ in a single entry.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Mode = discovery::PeerParameters::SamePeerMode;
+
+std::list<discovery::DiscoveredPeer> MakePeers(size_t count, uint32_t first_ip) {
+  std::list<discovery::DiscoveredPeer> peers;
+  for (size_t i = 0; i < count; ++i) {
+    peers.emplace_back();
+    peers.back().set_ip_port(discovery::IpPort(first_ip + static_cast<uint32_t>(i), 12345));
+    peers.back().SetUserData("peer-" + std::to_string(i), 1);
+  }
+  return peers;
+}
+
+bool QuadraticSame(Mode mode, const std::list<discovery::DiscoveredPeer>& lhv,
+                   const std::list<discovery::DiscoveredPeer>& rhv) {
+  for (const auto& lhv_peer : lhv) {
+    auto in_rhv = std::find_if(rhv.begin(), rhv.end(), [mode, &lhv_peer](const discovery::DiscoveredPeer& rhv_peer) {
+      return discovery::Same(mode, lhv_peer.ip_port(), rhv_peer.ip_port());
+    });
+    if (in_rhv == rhv.end()) {
+      return false;
+    }
+  }
+  for (const auto& rhv_peer : rhv) {
+    auto in_lhv = std::find_if(lhv.begin(), lhv.end(), [mode, &rhv_peer](const discovery::DiscoveredPeer& lhv_peer) {
+      return discovery::Same(mode, rhv_peer.ip_port(), lhv_peer.ip_port());
+    });
+    if (in_lhv == lhv.end()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Func>
+double MeasureUs(Func func) {
+  auto start = Clock::now();
+  func();
+  return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+}  // namespace
+
+int main() {
+  const size_t kPeerCounts[] = {100, 1000, 10000};
+
+  std::cout << std::setw(8) << "peers" << std::setw(18) << "quadratic us" << std::setw(14) << "Same us"
+            << std::setw(14) << "Diff us" << std::endl;
+
+  for (size_t peer_count : kPeerCounts) {
+    auto before = MakePeers(peer_count, 0x0a000000u);
+    auto after = before;
+    // The last peer of after is replaced, so every scan has to run to the end.
+    after.back().set_ip_port(discovery::IpPort(0x0b000000u, 12345));
+
+    bool quadratic_same = true;
+    bool same = true;
+    discovery::PeerChanges changes;
+    double quadratic_us = MeasureUs([&]() { quadratic_same = QuadraticSame(Mode::kIpAndPort, before, after); });
+    double same_us = MeasureUs([&]() { same = discovery::Same(Mode::kIpAndPort, before, after); });
+    double diff_us = MeasureUs([&]() { changes = discovery::Diff(Mode::kIpAndPort, before, after); });
+
+    if (quadratic_same != same || changes.added().size() != 1 || changes.removed().size() != 1) {
+      std::cerr << "result mismatch at " << peer_count << " peers" << std::endl;
+      return 1;
+    }
+
+    std::cout << std::setw(8) << peer_count << std::fixed << std::setprecision(1) << std::setw(18) << quadratic_us
+              << std::setw(14) << same_us << std::setw(14) << diff_us << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <random>
+#include <vector>
+
+#include "discovery/discovery_peer.h"
+#include "discovery_peer_table.h"
+
+// Measures the per-packet cost of locating and refreshing a peer entry, which
+// is what every accepted heartbeat does under the receive lock. The indexed
+// table should stay flat as the population grows; the list scan it replaced
+// is shown for comparison up to the sizes where it is still tolerable.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kLookups = 1000000;
+constexpr size_t kMaxListPeers = 5000;
+
+std::vector<discovery::IpPort> MakeAddresses(size_t count) {
+  std::vector<discovery::IpPort> addresses;
+  addresses.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    // 10.x.y.z with a per-peer ephemeral port.
+    uint32_t ip = 0x0a000000u | static_cast<uint32_t>(i & 0xffffff);
+    addresses.emplace_back(ip, static_cast<uint16_t>(40000 + (i % 20000)));
+  }
+  return addresses;
+}
+
+std::vector<uint32_t> MakeSequence(size_t peer_count, size_t length) {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<uint32_t> dis(0, static_cast<uint32_t>(peer_count - 1));
+  std::vector<uint32_t> sequence(length);
+  for (auto& index : sequence) {
+    index = dis(gen);
+  }
+  return sequence;
+}
+
+double BenchTable(const std::vector<discovery::IpPort>& addresses, const std::vector<uint32_t>& sequence) {
+  discovery::impl::PeerTable table(discovery::PeerParameters::SamePeerMode::kIpAndPort);
+  for (const auto& address : addresses) {
+    table.Insert(address, 0);
+  }
+
+  int64_t now = 0;
+  auto start = Clock::now();
+  for (uint32_t index : sequence) {
+    discovery::DiscoveredPeer* peer = table.Find(addresses[index]);
+    if (peer == nullptr) {
+      peer = &table.Insert(addresses[index], now);
+    }
+    peer->set_last_updated(++now);
+  }
+  auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  return elapsed / static_cast<double>(sequence.size());
+}
+
+double BenchList(const std::vector<discovery::IpPort>& addresses, const std::vector<uint32_t>& sequence) {
+  std::list<discovery::DiscoveredPeer> peers;
+  for (const auto& address : addresses) {
+    peers.emplace_back();
+    peers.back().set_ip_port(address);
+  }
+
+  int64_t now = 0;
+  auto start = Clock::now();
+  for (uint32_t index : sequence) {
+    const auto& from = addresses[index];
+    auto find_it = std::find_if(peers.begin(), peers.end(), [&from](const discovery::DiscoveredPeer& peer) {
+      return discovery::Same(discovery::PeerParameters::SamePeerMode::kIpAndPort, peer.ip_port(), from);
+    });
+    find_it->set_last_updated(++now);
+  }
+  auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  return elapsed / static_cast<double>(sequence.size());
+}
+
+}  // namespace
+
+int main() {
+  const size_t kPeerCounts[] = {10, 100, 1000, 10000, 50000};
+
+  std::cout << std::setw(10) << "peers" << std::setw(16) << "table ns/pkt" << std::setw(16) << "list ns/pkt"
+            << std::endl;
+
+  for (size_t peer_count : kPeerCounts) {
+    auto addresses = MakeAddresses(peer_count);
+    double table_ns = BenchTable(addresses, MakeSequence(peer_count, kLookups));
+
+    std::cout << std::setw(10) << peer_count << std::setw(16) << std::fixed << std::setprecision(1) << table_ns;
+    if (peer_count <= kMaxListPeers) {
+      // Keep the quadratic baseline bounded in wall time.
+      double list_ns = BenchList(addresses, MakeSequence(peer_count, kLookups / std::max<size_t>(1, peer_count / 100)));
+      std::cout << std::setw(16) << list_ns;
+    } else {
+      std::cout << std::setw(16) << "-";
+    }
+    std::cout << std::endl;
+  }
+
+  return 0;
+}
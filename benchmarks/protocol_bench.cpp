@@ -0,0 +1,166 @@
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "discovery/discovery_protocol.h"
+
+// Compares the fixed-layout header codec against the byte-at-a-time
+// BufferView codec it replaced, and checks that both produce and accept the
+// same bytes.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct LegacyPacket {
+  uint8_t packet_type = 0;
+  uint32_t application_id = 0;
+  uint32_t peer_id = 0;
+  uint64_t snapshot_index = 0;
+  std::string user_data;
+};
+
+bool LegacySerialize(LegacyPacket* packet, std::string* buffer) {
+  using discovery::impl::kSerialize;
+  using discovery::impl::SerializeUnsignedIntegerBigEndian;
+
+  discovery::impl::BufferView buffer_view(buffer);
+  for (char c : {'D', 'S', 'C', 'V'}) {
+    buffer_view.push_back(c);
+  }
+  uint8_t version = 1;
+  uint8_t reserved = 0;
+  auto user_data_size = static_cast<uint16_t>(packet->user_data.size());
+  SerializeUnsignedIntegerBigEndian(kSerialize, &version, &buffer_view);
+  for (int i = 0; i < 3; ++i) {
+    SerializeUnsignedIntegerBigEndian(kSerialize, &reserved, &buffer_view);
+  }
+  SerializeUnsignedIntegerBigEndian(kSerialize, &packet->packet_type, &buffer_view);
+  SerializeUnsignedIntegerBigEndian(kSerialize, &packet->application_id, &buffer_view);
+  SerializeUnsignedIntegerBigEndian(kSerialize, &packet->peer_id, &buffer_view);
+  SerializeUnsignedIntegerBigEndian(kSerialize, &packet->snapshot_index, &buffer_view);
+  SerializeUnsignedIntegerBigEndian(kSerialize, &user_data_size, &buffer_view);
+  return discovery::impl::SerializeString(kSerialize, &packet->user_data, user_data_size, &buffer_view);
+}
+
+bool LegacyParse(const std::string& buffer, LegacyPacket* packet) {
+  using discovery::impl::kParse;
+  using discovery::impl::SerializeUnsignedIntegerBigEndian;
+
+  discovery::impl::BufferView buffer_view(buffer.data(), buffer.size());
+  for (char expected : {'D', 'S', 'C', 'V'}) {
+    uint8_t byte = 0;
+    if (!SerializeUnsignedIntegerBigEndian(kParse, &byte, &buffer_view) || byte != static_cast<uint8_t>(expected)) {
+      return false;
+    }
+  }
+  uint8_t version = 0;
+  if (!SerializeUnsignedIntegerBigEndian(kParse, &version, &buffer_view) || version != 1) {
+    return false;
+  }
+  uint8_t reserved = 0;
+  for (int i = 0; i < 3; ++i) {
+    if (!SerializeUnsignedIntegerBigEndian(kParse, &reserved, &buffer_view)) {
+      return false;
+    }
+  }
+  uint16_t user_data_size = 0;
+  if (!SerializeUnsignedIntegerBigEndian(kParse, &packet->packet_type, &buffer_view) ||
+      discovery::impl::GetPacketType(packet->packet_type) == discovery::kPacketTypeUnknown ||
+      !SerializeUnsignedIntegerBigEndian(kParse, &packet->application_id, &buffer_view) ||
+      !SerializeUnsignedIntegerBigEndian(kParse, &packet->peer_id, &buffer_view) ||
+      !SerializeUnsignedIntegerBigEndian(kParse, &packet->snapshot_index, &buffer_view) ||
+      !SerializeUnsignedIntegerBigEndian(kParse, &user_data_size, &buffer_view)) {
+    return false;
+  }
+  if (user_data_size > discovery::kMaxUserDataSize || buffer_view.LeftUnparsed() != user_data_size) {
+    return false;
+  }
+  return discovery::impl::SerializeString(kParse, &packet->user_data, user_data_size, &buffer_view);
+}
+
+template <typename Func>
+double MeasureNsPerOp(size_t iterations, Func func) {
+  auto start = Clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    func(i);
+  }
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(iterations);
+}
+
+}  // namespace
+
+int main() {
+  const size_t kPayloadSizes[] = {0, 64, 1024, 4096};
+  const size_t kIterations = 200000;
+  std::mt19937_64 random(42);
+
+  std::cout << std::setw(10) << "payload" << std::setw(18) << "legacy ser ns" << std::setw(14) << "ser ns"
+            << std::setw(18) << "legacy parse ns" << std::setw(14) << "parse ns" << std::endl;
+
+  for (size_t payload_size : kPayloadSizes) {
+    LegacyPacket legacy;
+    legacy.packet_type = 0;
+    legacy.application_id = static_cast<uint32_t>(random());
+    legacy.peer_id = static_cast<uint32_t>(random());
+    legacy.snapshot_index = random();
+    legacy.user_data.resize(payload_size);
+    for (char& c : legacy.user_data) {
+      c = static_cast<char>(random());
+    }
+
+    discovery::Packet packet;
+    packet.set_packet_type(discovery::kPacketIAmHere);
+    packet.set_application_id(legacy.application_id);
+    packet.set_peer_id(legacy.peer_id);
+    packet.set_snapshot_index(legacy.snapshot_index);
+    packet.set_user_data(legacy.user_data);
+
+    // Both codecs must agree byte for byte in both directions.
+    std::string legacy_bytes;
+    std::string bytes;
+    LegacySerialize(&legacy, &legacy_bytes);
+    packet.Serialize(bytes);
+    LegacyPacket legacy_parsed;
+    discovery::Packet parsed;
+    if (legacy_bytes != bytes || !LegacyParse(bytes, &legacy_parsed) || !parsed.Parse(legacy_bytes) ||
+        parsed.peer_id() != legacy.peer_id || parsed.snapshot_index() != legacy.snapshot_index ||
+        parsed.user_data() != legacy.user_data || legacy_parsed.user_data != legacy.user_data) {
+      std::cerr << "codec mismatch at payload " << payload_size << std::endl;
+      return 1;
+    }
+
+    size_t checksum = 0;
+    std::string buffer;
+    double legacy_serialize_ns = MeasureNsPerOp(kIterations, [&](size_t i) {
+      buffer.clear();
+      legacy.snapshot_index = i;
+      LegacySerialize(&legacy, &buffer);
+      checksum += buffer.size();
+    });
+    double serialize_ns = MeasureNsPerOp(kIterations, [&](size_t i) {
+      buffer.clear();
+      packet.set_snapshot_index(i);
+      packet.Serialize(buffer);
+      checksum += buffer.size();
+    });
+    double legacy_parse_ns = MeasureNsPerOp(kIterations, [&](size_t) {
+      checksum += LegacyParse(bytes, &legacy_parsed) ? legacy_parsed.user_data.size() : 0;
+    });
+    double parse_ns = MeasureNsPerOp(kIterations, [&](size_t) {
+      checksum += parsed.Parse(bytes) ? parsed.user_data().size() : 0;
+    });
+
+    std::cout << std::setw(10) << payload_size << std::fixed << std::setprecision(1) << std::setw(18)
+              << legacy_serialize_ns << std::setw(14) << serialize_ns << std::setw(18) << legacy_parse_ns
+              << std::setw(14) << parse_ns << std::endl;
+    // Keep the measured loops from being optimized away.
+    volatile size_t sink = checksum;
+    (void)sink;
+  }
+
+  return 0;
+}
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "discovery/discovery_peer.h"
+#include "discovery_simulated_network.h"
+
+// Scale scenarios run on impl::SimulatedNetwork in virtual time: how long a
+// new discoverer takes to see 1k and 10k peers, how long crashed peers
+// linger before they expire, how closely the discovered table tracks a
+// churning population, whether peers that do not discover keep to
+// max_announce_rate and whether query responses are spread out. Every
+// scenario checks its outcome and the program
+// exits with 1 if one fails, so it can gate changes in CI.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using discovery::impl::SimulatedNetwork;
+
+constexpr uint16_t kPort = 23531;
+constexpr uint32_t kApplicationId = 0x5117;
+constexpr int64_t kSendTimeoutMs = 1000;
+constexpr int64_t kTtlMs = 5000;
+
+discovery::PeerParameters MakeParameters(bool discover) {
+  discovery::PeerParameters parameters;
+  parameters.set_port(kPort);
+  parameters.set_application_id(kApplicationId);
+  parameters.set_send_timeout_ms(kSendTimeoutMs);
+  parameters.set_discovered_peer_ttl_ms(kTtlMs);
+  parameters.set_send_jitter(0.5);
+  parameters.set_can_discover(discover);
+  parameters.set_can_be_discovered(!discover);
+  // Without queries the population does not listen, which keeps the
+  // scenarios with 10k peers fast; Query() turns them on.
+  parameters.set_use_queries(false);
+  return parameters;
+}
+
+// Adds count announcing peers and returns their indices.
+std::vector<size_t> AddPopulation(SimulatedNetwork& network, size_t count) {
+  std::vector<size_t> peers;
+  for (size_t i = 0; i < count; ++i) {
+    peers.push_back(network.AddPeer(MakeParameters(false), "peer-" + std::to_string(i)));
+  }
+  return peers;
+}
+
+double WallMs(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Prints one scenario result and returns passed.
+bool Report(const std::string& scenario, const std::string& outcome, double wall_ms, bool passed) {
+  std::cout << std::left << std::setw(36) << scenario << std::setw(44) << outcome << std::right << std::fixed
+            << std::setprecision(0) << std::setw(8) << wall_ms << " ms wall" << (passed ? "" : "  FAILED")
+            << std::endl;
+  return passed;
+}
+
+// A discoverer joins a settled population and waits for its full view. The
+// population does not listen, so it does not answer queries and the
+// discoverer depends on the periodic announcements.
+bool Convergence(size_t population_size, double loss_rate) {
+  auto wall_start = Clock::now();
+  SimulatedNetwork network;
+  network.set_loss_rate(loss_rate);
+  network.set_delay_ms(1, 10);
+  AddPopulation(network, population_size);
+  network.RunFor(2 * kSendTimeoutMs);
+
+  size_t discoverer = network.AddPeer(MakeParameters(true), "discoverer");
+  int64_t start_ms = network.now_ms();
+  bool converged = network.RunUntil(
+      [&]() { return network.Snapshot(discoverer)->size() >= population_size; }, 10 * kSendTimeoutMs);
+
+  std::ostringstream scenario;
+  scenario << "convergence n=" << population_size << " loss=" << loss_rate * 100 << "%";
+  std::ostringstream outcome;
+  outcome << "full view after " << network.now_ms() - start_ms << " ms";
+  return Report(scenario.str(), converged ? outcome.str() : "no full view", WallMs(wall_start), converged);
+}
+
+// A tenth of the population crashes; the discoverer has to expire them
+// within the TTL.
+bool Expiry(size_t population_size) {
+  auto wall_start = Clock::now();
+  SimulatedNetwork network;
+  network.set_delay_ms(1, 10);
+  std::vector<size_t> peers = AddPopulation(network, population_size);
+  size_t discoverer = network.AddPeer(MakeParameters(true), "discoverer");
+  network.RunUntil([&]() { return network.Snapshot(discoverer)->size() >= population_size; }, 10 * kSendTimeoutMs);
+
+  size_t crashed = population_size / 10;
+  for (size_t i = 0; i < crashed; ++i) {
+    network.CrashPeer(peers[i]);
+  }
+  int64_t start_ms = network.now_ms();
+  bool expired = network.RunUntil(
+      [&]() { return network.Snapshot(discoverer)->size() == population_size - crashed; }, 3 * kTtlMs);
+  int64_t elapsed_ms = network.now_ms() - start_ms;
+  // A copy still in flight at the crash refreshes its sender once more.
+  bool passed = expired && elapsed_ms <= kTtlMs + network.max_delay_ms();
+
+  std::ostringstream scenario;
+  scenario << "expiry n=" << population_size << " crashed=" << crashed;
+  std::ostringstream outcome;
+  outcome << "all expired after " << elapsed_ms << " ms (ttl " << kTtlMs << ")";
+  return Report(scenario.str(), expired ? outcome.str() : "crashed peers not expired", WallMs(wall_start), passed);
+}
+
+// Every 10 ms a random peer leaves, gracefully or by crashing, and a new
+// one joins. The table is compared with the live population once a second;
+// after the churn stops it must match exactly within the TTL.
+bool Churn(size_t population_size) {
+  auto wall_start = Clock::now();
+  SimulatedNetwork network(7);
+  network.set_loss_rate(0.01);
+  network.set_delay_ms(1, 10);
+  std::vector<size_t> live = AddPopulation(network, population_size);
+  size_t discoverer = network.AddPeer(MakeParameters(true), "discoverer");
+  network.RunFor(2 * kSendTimeoutMs);
+
+  // Entries of peers that have left, and live peers missing from the table.
+  auto count_stale = [&]() {
+    size_t stale = 0;
+    for (const auto& peer : *network.Snapshot(discoverer)) {
+      // Simulated addresses are 10.x.y.z with x.y.z = index + 1.
+      size_t index = (peer.ip_port().ip() & 0xffffff) - 1;
+      if (!network.running(index)) {
+        ++stale;
+      }
+    }
+    return stale;
+  };
+  auto count_missing = [&]() { return live.size() + count_stale() - network.Snapshot(discoverer)->size(); };
+
+  std::mt19937 gen(11);
+  constexpr int64_t kChurnMs = 30000;
+  constexpr int64_t kChurnIntervalMs = 10;
+  size_t stale_sum = 0;
+  size_t samples = 0;
+  for (int64_t t = 0; t < kChurnMs; t += kChurnIntervalMs) {
+    size_t victim = std::uniform_int_distribution<size_t>(0, live.size() - 1)(gen);
+    if (gen() % 2 == 0) {
+      network.StopPeer(live[victim]);
+    } else {
+      network.CrashPeer(live[victim]);
+    }
+    live[victim] = network.AddPeer(MakeParameters(false), "peer-" + std::to_string(network.peer_count()));
+    network.RunFor(kChurnIntervalMs);
+    if (t % 1000 == 0) {
+      stale_sum += count_stale();
+      ++samples;
+    }
+  }
+  network.RunFor(kTtlMs + 2 * kSendTimeoutMs);
+  size_t stale = count_stale();
+  size_t missing = count_missing();
+  bool passed = stale == 0 && missing == 0;
+
+  std::ostringstream scenario;
+  scenario << "churn n=" << population_size << " 100/s loss=1%";
+  std::ostringstream outcome;
+  outcome << "avg stale " << stale_sum / samples << ", settled stale " << stale << " missing " << missing;
+  return Report(scenario.str(), outcome.str(), WallMs(wall_start), passed);
+}
+
+// A population that does not discover, with max_announce_rate set, has to
+// count itself and stretch its intervals until the whole population sends
+// about that rate, while a discoverer keeps the full view.
+bool AnnounceRate(size_t population_size, double max_announce_rate) {
+  auto wall_start = Clock::now();
+  SimulatedNetwork network;
+  network.set_delay_ms(1, 10);
+  for (size_t i = 0; i < population_size; ++i) {
+    discovery::PeerParameters parameters = MakeParameters(false);
+    parameters.set_max_announce_rate(max_announce_rate);
+    network.AddPeer(parameters, "peer-" + std::to_string(i));
+  }
+  discovery::PeerParameters parameters = MakeParameters(true);
+  parameters.set_max_announce_rate(max_announce_rate);
+  size_t discoverer = network.AddPeer(parameters, "discoverer");
+  network.RunFor(20 * kSendTimeoutMs);
+
+  constexpr int64_t kMeasureMs = 20 * kSendTimeoutMs;
+  uint64_t sent_before = network.datagrams_sent();
+  network.RunFor(kMeasureMs);
+  double rate = static_cast<double>(network.datagrams_sent() - sent_before) * 1000.0 / kMeasureMs;
+  size_t discovered = network.Snapshot(discoverer)->size();
+  bool passed = rate <= 1.5 * max_announce_rate && discovered == population_size;
+
+  std::ostringstream scenario;
+  scenario << "announce rate n=" << population_size << " max=" << max_announce_rate << "/s";
+  std::ostringstream outcome;
+  outcome << std::fixed << std::setprecision(0) << rate << "/s sent, " << discovered << " discovered";
+  return Report(scenario.str(), outcome.str(), WallMs(wall_start), passed);
+}
+
+// A discoverer queries a settled population that answers queries. The
+// responses have to reach it well before the periodic announcements would,
+// but spread over a window sized from the population instead of arriving
+// all at once.
+bool Query(size_t population_size) {
+  auto wall_start = Clock::now();
+  SimulatedNetwork network;
+  network.set_delay_ms(1, 10);
+  for (size_t i = 0; i < population_size; ++i) {
+    discovery::PeerParameters parameters = MakeParameters(false);
+    parameters.set_use_queries(true);
+    network.AddPeer(parameters, "peer-" + std::to_string(i));
+  }
+  network.RunFor(2 * kSendTimeoutMs);
+
+  discovery::PeerParameters parameters = MakeParameters(true);
+  parameters.set_use_queries(true);
+  size_t discoverer = network.AddPeer(parameters, "discoverer");
+  int64_t start_ms = network.now_ms();
+  constexpr int64_t kBucketMs = 10;
+  uint64_t peak_sent = 0;
+  bool converged = false;
+  while (!converged && network.now_ms() - start_ms < 2 * kSendTimeoutMs) {
+    uint64_t sent_before = network.datagrams_sent();
+    network.RunFor(kBucketMs);
+    peak_sent = std::max(peak_sent, network.datagrams_sent() - sent_before);
+    converged = network.Snapshot(discoverer)->size() >= population_size;
+  }
+  int64_t elapsed_ms = network.now_ms() - start_ms;
+  double peak_rate = static_cast<double>(peak_sent) * 1000.0 / kBucketMs;
+  // Responses at 1000/s on top of the periodic announcements, with room
+  // for the randomness of a 10 ms bucket.
+  double allowed_rate = 2 * (1000.0 + static_cast<double>(population_size) * 1000.0 / kSendTimeoutMs);
+  bool passed = converged && elapsed_ms < kSendTimeoutMs && peak_rate <= allowed_rate;
+
+  std::ostringstream scenario;
+  scenario << "query n=" << population_size;
+  std::ostringstream outcome;
+  outcome << std::fixed << std::setprecision(0) << "full view after " << elapsed_ms << " ms, peak " << peak_rate
+          << "/s";
+  return Report(scenario.str(), converged ? outcome.str() : "no full view", WallMs(wall_start), passed);
+}
+
+}  // namespace
+
+int main() {
+  bool passed = true;
+  passed &= Convergence(1000, 0);
+  passed &= Convergence(10000, 0);
+  passed &= Convergence(10000, 0.05);
+  passed &= Expiry(10000);
+  passed &= Churn(1000);
+  passed &= AnnounceRate(300, 30);
+  passed &= Query(500);
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "discovery/discovery_peer.h"
+#include "discovery/discovery_protocol.h"
+
+#if !defined(_WIN32)
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Sends the same mix of foreign and malformed datagrams and real
+// announcements at a listening Peer twice, once with the kernel socket
+// filter (PeerParameters::use_socket_filter()) and once without, and
+// compares how many datagrams reached the Peer. The discovered tables have
+// to be identical; the program exits with 1 if they differ or if the filter
+// let junk through.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint16_t kPort = 23541;
+constexpr uint32_t kApplicationId = 0xf117e;
+constexpr size_t kPeerCount = 20;
+constexpr size_t kJunkRounds = 2000;
+
+// Sorted (address, user_data) pairs of a discovered table.
+using TableContents = std::vector<std::pair<uint64_t, std::string>>;
+
+struct RunResult {
+  discovery::PeerStats stats;
+  TableContents table;
+};
+
+std::string MakeAnnouncement(uint32_t application_id, uint32_t peer_id, const std::string& user_data) {
+  discovery::Packet packet;
+  packet.set_packet_type(discovery::kPacketIAmHere);
+  packet.set_application_id(application_id);
+  packet.set_peer_id(peer_id);
+  packet.set_snapshot_index(1);
+  packet.set_user_data(user_data);
+  std::string datagram;
+  packet.Serialize(datagram);
+  return datagram;
+}
+
+// One datagram of every kind the filter has to drop.
+std::vector<std::string> MakeJunk() {
+  std::string valid = MakeAnnouncement(kApplicationId, 0x7777, "junk");
+  std::vector<std::string> junk;
+  junk.push_back(MakeAnnouncement(kApplicationId + 1, 0x7777, "other application"));
+  junk.push_back(valid.substr(0, discovery::kPacketHeaderSize - 1));
+  junk.push_back(valid);
+  junk.back()[0] = 'X';
+  junk.push_back(valid);
+  junk.back()[4] = 2;
+  junk.push_back(valid);
+  junk.back()[8] = 6;
+  junk.push_back(std::string(64, '\0'));
+  return junk;
+}
+
+TableContents Contents(const discovery::Peer& peer) {
+  TableContents contents;
+  for (const auto& discovered : *peer.Snapshot()) {
+    uint64_t address = (static_cast<uint64_t>(discovered.ip_port().ip()) << 16) | discovered.ip_port().port();
+    contents.emplace_back(address, discovered.user_data());
+  }
+  std::sort(contents.begin(), contents.end());
+  return contents;
+}
+
+bool Run(bool use_socket_filter, const std::vector<int>& sockets, RunResult* result) {
+  discovery::PeerParameters parameters;
+  parameters.set_port(kPort);
+  parameters.set_application_id(kApplicationId);
+  parameters.set_can_discover(true);
+  parameters.set_can_be_discovered(false);
+  parameters.set_discovered_peer_ttl_ms(60000);
+  parameters.set_use_socket_filter(use_socket_filter);
+  discovery::Peer listener;
+  if (!listener.Start(parameters, "listener")) {
+    std::cerr << "failed to start the listening peer" << std::endl;
+    return false;
+  }
+
+  sockaddr_in to{};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(kPort);
+  to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  auto send = [&to](int sock, const std::string& datagram) {
+    sendto(sock, datagram.data(), datagram.size(), 0, reinterpret_cast<sockaddr*>(&to), sizeof(to));
+  };
+
+  // Junk from the first socket, paced so that the unfiltered Peer keeps up,
+  // then announcements of every fake peer until the Peer has seen them all.
+  std::vector<std::string> junk = MakeJunk();
+  for (size_t round = 0; round < kJunkRounds; ++round) {
+    for (const auto& datagram : junk) {
+      send(sockets[0], datagram);
+    }
+    if (round % 10 == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  auto deadline = Clock::now() + std::chrono::seconds(5);
+  do {
+    for (size_t i = 0; i < sockets.size(); ++i) {
+      send(sockets[i], MakeAnnouncement(kApplicationId, static_cast<uint32_t>(i + 1), "peer-" + std::to_string(i)));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  } while (listener.Snapshot()->size() < sockets.size() && Clock::now() < deadline);
+  result->stats = listener.GetStats();
+  result->table = Contents(listener);
+  listener.StopAndWaitForThreads();
+  return true;
+}
+
+// Datagrams the Peer rejected, leaving out its own queries.
+uint64_t JunkReceived(const RunResult& result) {
+  return result.stats.packets_rejected() - result.stats.rejected_self();
+}
+
+void Print(const char* label, const RunResult& result) {
+  std::cout << std::left << std::setw(12) << label << std::right << "received " << std::setw(8)
+            << result.stats.packets_received() << "  accepted " << std::setw(4) << result.stats.packets_accepted()
+            << "  junk " << std::setw(8) << JunkReceived(result) << "  discovered " << result.table.size() << std::endl;
+}
+
+}  // namespace
+
+#if defined(_WIN32)
+
+int main() {
+  std::cerr << "discovery_socket_filter_bench is not supported on this platform" << std::endl;
+  return 1;
+}
+
+#else
+
+int main() {
+  std::vector<int> sockets;
+  for (size_t i = 0; i < kPeerCount; ++i) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+      std::cerr << "failed to open a sending socket" << std::endl;
+      return 1;
+    }
+    // Bound once, so both runs see the fake peers at the same addresses.
+    sockaddr_in any{};
+    any.sin_family = AF_INET;
+    bind(sock, reinterpret_cast<sockaddr*>(&any), sizeof(any));
+    sockets.push_back(sock);
+  }
+
+  RunResult unfiltered;
+  RunResult filtered;
+  bool ran = Run(false, sockets, &unfiltered) && Run(true, sockets, &filtered);
+  for (int sock : sockets) {
+    close(sock);
+  }
+  if (!ran) {
+    return 1;
+  }
+  Print("unfiltered", unfiltered);
+  Print("filtered", filtered);
+
+  bool same_table = filtered.table == unfiltered.table && filtered.table.size() == kPeerCount;
+  bool junk_dropped = JunkReceived(filtered) == 0 && JunkReceived(unfiltered) > 0 &&
+                      filtered.stats.packets_received() < unfiltered.stats.packets_received();
+  std::cout << "tables " << (same_table ? "identical" : "DIFFER") << ", junk "
+            << (junk_dropped ? "dropped in the kernel" : "NOT DROPPED") << std::endl;
+  return same_table && junk_dropped ? 0 : 1;
+}
+
+#endif
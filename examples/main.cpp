@@ -1,9 +1,8 @@
 #include <chrono>
 #include <cstdlib>
 #include <iostream>
-#include <map>
 #include <string>
-#include <thread>
+#include <vector>
 
 #include "discovery/discovery_peer.h"
 
@@ -46,54 +45,34 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  std::list<discovery::DiscoveredPeer> discovered_peers;
-  std::map<discovery::IpPort, std::string> last_seen_user_datas;
+  auto subscription = peer.Subscribe();
+  std::vector<discovery::PeerEvent> events;
 
-  while (true) {
-    auto new_discovered_peers = peer.ListDiscovered();
-    if (!discovery::Same(parameters.same_peer_mode(), discovered_peers, new_discovered_peers)) {
-      discovered_peers = new_discovered_peers;
-
-      last_seen_user_datas.clear();
-      for (const auto& p : discovered_peers) {
-        last_seen_user_datas.insert(std::make_pair(p.ip_port(), p.user_data()));
-      }
-
-      std::cout << "Discovered peers: " << discovered_peers.size() << std::endl;
-      for (const auto& p : discovered_peers) {
-        std::cout << " - " << discovery::IpToString(p.ip_port().ip()) << ", " << p.user_data() << std::endl;
-      }
-    } else {
-      bool same_user_datas = true;
-      for (const auto& p : new_discovered_peers) {
-        auto find_it = last_seen_user_datas.find(p.ip_port());
-        if (find_it != last_seen_user_datas.end()) {
-          if (find_it->second != p.user_data()) {
-            same_user_datas = false;
-            break;
+  while (subscription->WaitEvents(events, std::chrono::seconds(1))) {
+    for (const auto& event : events) {
+      const auto& p = event.peer();
+      switch (event.type()) {
+        case discovery::PeerEventType::kJoined:
+          std::cout << " + " << discovery::IpToString(p.ip_port().ip()) << ", " << p.user_data() << std::endl;
+          break;
+        case discovery::PeerEventType::kUserDataChanged:
+          std::cout << " * " << discovery::IpToString(p.ip_port().ip()) << ", " << p.user_data() << std::endl;
+          break;
+        case discovery::PeerEventType::kLeft:
+        case discovery::PeerEventType::kExpired:
+          std::cout << " - " << discovery::IpToString(p.ip_port().ip()) << std::endl;
+          break;
+        case discovery::PeerEventType::kOverflow: {
+          auto discovered_peers = peer.ListDiscovered();
+          std::cout << "Discovered peers: " << discovered_peers.size() << std::endl;
+          for (const auto& d : discovered_peers) {
+            std::cout << " - " << discovery::IpToString(d.ip_port().ip()) << ", " << d.user_data() << std::endl;
           }
-        } else {
-          same_user_datas = false;
           break;
         }
       }
-
-      if (!same_user_datas) {
-        discovered_peers = new_discovered_peers;
-
-        last_seen_user_datas.clear();
-        for (const auto& p : discovered_peers) {
-          last_seen_user_datas.insert(std::make_pair(p.ip_port(), p.user_data()));
-        }
-
-        std::cout << "Discovered peers: " << discovered_peers.size() << std::endl;
-        for (const auto& p : discovered_peers) {
-          std::cout << " - " << discovery::IpToString(p.ip_port().ip()) << ", " << p.user_data() << std::endl;
-        }
-      }
     }
-
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    events.clear();
   }
 
   peer.Stop(true);
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 
 #include "discovery_ip_port.h"
 
@@ -20,16 +21,22 @@ class DiscoveredPeer {
 
   const std::string& user_data() const { return user_data_; }
 
-  // Returns the snapshot_index of the last packet that updated user_data.
+  // Returns the snapshot_index of the newest packet accepted from this peer.
   // Used to discard stale packets that arrive out of order.
   uint64_t last_received_packet() const { return last_received_packet_; }
+  void set_last_received_packet(uint64_t last_received_packet) { last_received_packet_ = last_received_packet; }
 
   // Updates user_data only when snapshot_index is newer than the last seen one.
-  void SetUserData(const std::string& user_data, uint64_t last_received_packet) {
-    user_data_ = user_data;
+  void SetUserData(std::string_view user_data, uint64_t last_received_packet) {
+    user_data_.assign(user_data.data(), user_data.size());
     last_received_packet_ = last_received_packet;
   }
 
+  // Digest of user_data as announced in the peer's heartbeats; compared
+  // against incoming heartbeats to detect changes that were missed.
+  uint64_t user_data_digest() const { return user_data_digest_; }
+  void set_user_data_digest(uint64_t user_data_digest) { user_data_digest_ = user_data_digest; }
+
   // Timestamp (ms) of the most recently received packet from this peer.
   int64_t last_updated() const { return last_updated_; }
   void set_last_updated(int64_t last_updated) { last_updated_ = last_updated; }
@@ -38,6 +45,7 @@ class DiscoveredPeer {
   IpPort ip_port_;
   std::string user_data_;
   uint64_t last_received_packet_ = 0;
+  uint64_t user_data_digest_ = 0;
   int64_t last_updated_ = 0;
 };
 
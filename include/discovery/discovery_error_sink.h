@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace discovery {
+
+// Receives error messages of the library, such as socket setup or send
+// failures. May be called from any library thread, and must not call back
+// into the library.
+using ErrorSink = std::function<void(const std::string& message)>;
+
+// Minimum time between two reports of the same message.
+constexpr int64_t kErrorReportIntervalMs = 1000;
+
+// Installs sink as the process-wide receiver of error messages; nullptr
+// restores the default, which writes to std::cerr. Each distinct message is
+// passed on at most once per kErrorReportIntervalMs; the number of repeats
+// dropped in between is appended to its next report.
+void SetErrorSink(ErrorSink sink);
+
+namespace impl {
+
+// Passes message to the installed ErrorSink, subject to rate limiting.
+void ReportError(const std::string& message);
+
+}  // namespace impl
+}  // namespace discovery
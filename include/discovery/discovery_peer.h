@@ -5,12 +5,19 @@
 #include <memory>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "discovery_discovered_peer.h"
+#include "discovery_peer_events.h"
 #include "discovery_peer_parameters.h"
+#include "discovery_peer_stats.h"
 
 namespace discovery {
 
+// Immutable list of discovered peers shared between all readers that obtained
+// it. See Peer::Snapshot().
+using DiscoveredPeersSnapshot = std::shared_ptr<const std::vector<DiscoveredPeer>>;
+
 namespace impl {
 
 // Returns the current time as milliseconds since an unspecified epoch.
@@ -30,11 +37,19 @@ class PeerEnvInterface {
 
   virtual void SetUserData(const std::string& user_data) = 0;
   virtual std::list<DiscoveredPeer> ListDiscovered() = 0;
+  virtual DiscoveredPeersSnapshot Snapshot() = 0;
+  virtual PeerChanges ChangesSince(uint64_t generation) = 0;
+  virtual PeerStats GetStats() = 0;
+  virtual std::shared_ptr<PeerSubscription> Subscribe(size_t max_queued_events) = 0;
   virtual void Exit() = 0;
+  // Blocks until the departure packet has been sent after Exit().
+  virtual void WaitForExit() = 0;
 };
 
 }  // namespace impl
 
+class PeerGroup;
+
 // Represents a participant in the peer discovery protocol.
 //
 // A Peer can broadcast its own presence, listen for other peers, or both,
@@ -55,13 +70,51 @@ class Peer {
   // are invalid or socket setup fails.
   bool Start(const PeerParameters& parameters, const std::string& user_data);
 
+  // Starts the peer as a member of a started group, which receives and
+  // sends announcements on its behalf instead of threads of its own. The
+  // port and multicast group in parameters must match the group's. The peer
+  // leaves the group when it stops; GetStats() then reports the counters of
+  // the group's shared socket.
+  bool Start(PeerGroup& group, const PeerParameters& parameters, const std::string& user_data);
+
   // Updates the user data broadcast to other peers. May be called at any
-  // time after Start(); the change takes effect on the next send interval.
+  // time after Start(); a changed value is announced immediately. User data
+  // longer than kMaxUserDataSize is sent in fragments, which peers built
+  // before fragmentation ignore; beyond kMaxLargeUserDataSize it is not
+  // announced at all.
   void SetUserData(const std::string& user_data);
 
   // Returns a snapshot of all currently discovered peers.
   std::list<DiscoveredPeer> ListDiscovered() const;
 
+  // Returns the most recently published snapshot of discovered peers without
+  // locking or copying. A new snapshot is published whenever a peer joins,
+  // leaves, expires or changes its user data, so last_updated() of its
+  // entries reflects the last such change rather than the last heartbeat.
+  // Never returns nullptr.
+  DiscoveredPeersSnapshot Snapshot() const;
+
+  // Returns what changed in the discovered table since the given generation,
+  // in time proportional to the number of changes. Pass 0 on the first call
+  // and the previous result's generation() afterwards. Every Start() numbers
+  // generations in a new random epoch, so a generation from an earlier run,
+  // like any other generation the peer cannot account for, yields a
+  // full_resync() result. So does a peer that is not running.
+  PeerChanges ChangesSince(uint64_t generation) const;
+
+  // Returns traffic counters accumulated since Start().
+  PeerStats GetStats() const;
+
+  // Default bound on events queued for a subscriber that is not draining.
+  static constexpr size_t kDefaultMaxQueuedEvents = 1024;
+
+  // Subscribes to membership changes. The subscription first receives a
+  // kJoined event for every peer already discovered, then events as they
+  // happen. It is closed when the peer stops; call Close() on it to
+  // unsubscribe earlier. Returns nullptr if the peer is not started or
+  // cannot discover.
+  std::shared_ptr<PeerSubscription> Subscribe(size_t max_queued_events = kDefaultMaxQueuedEvents);
+
   // Signals the peer to stop and returns immediately. Background threads
   // will finish on their own after sending a departure packet.
   void Stop();
@@ -85,7 +138,19 @@ class Peer {
 bool Same(PeerParameters::SamePeerMode mode, const IpPort& lhv, const IpPort& rhv);
 
 // Returns true if lhv and rhv contain exactly the same set of peers.
+// Runs in O(N log N).
 bool Same(PeerParameters::SamePeerMode mode, const std::list<DiscoveredPeer>& lhv,
           const std::list<DiscoveredPeer>& rhv);
+bool Same(PeerParameters::SamePeerMode mode, const std::vector<DiscoveredPeer>& lhv,
+          const std::vector<DiscoveredPeer>& rhv);
+
+// Compares two peer sets under the given mode. The result lists peers only
+// in after as added(), peers in both whose user data differs as updated()
+// (with their state in after) and the addresses of peers only in before as
+// removed(). Runs in O(N log N); generation() of the result is 0.
+PeerChanges Diff(PeerParameters::SamePeerMode mode, const std::list<DiscoveredPeer>& before,
+                 const std::list<DiscoveredPeer>& after);
+PeerChanges Diff(PeerParameters::SamePeerMode mode, const std::vector<DiscoveredPeer>& before,
+                 const std::vector<DiscoveredPeer>& after);
 
 }  // namespace discovery
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "discovery_discovered_peer.h"
+
+namespace discovery {
+
+// Kind of change reported to a PeerSubscription.
+enum class PeerEventType : uint8_t {
+  // A peer was discovered. Also reported for every already known peer when
+  // the subscription is created.
+  kJoined = 0,
+  // A known peer announced different user data.
+  kUserDataChanged = 1,
+  // A peer announced that it is leaving.
+  kLeft = 2,
+  // A peer was silent for longer than the discovered peer TTL.
+  kExpired = 3,
+  // The subscription queue overflowed and later events were dropped. The
+  // consumer should resynchronize with Peer::ListDiscovered().
+  kOverflow = 4,
+};
+
+// A single membership change. peer() holds the state of the peer as of the
+// change (for kLeft/kExpired, its last known state); it is empty for
+// kOverflow.
+class PeerEvent {
+ public:
+  PeerEvent() = default;
+  PeerEvent(PeerEventType type, const DiscoveredPeer& peer) : type_(type), peer_(peer) {}
+
+  PeerEventType type() const { return type_; }
+  const DiscoveredPeer& peer() const { return peer_; }
+
+ private:
+  PeerEventType type_ = PeerEventType::kJoined;
+  DiscoveredPeer peer_;
+};
+
+// The difference between the discovered table at some earlier generation and
+// its current state, as returned by Peer::ChangesSince().
+//
+// added() holds peers that were not known at the earlier generation,
+// updated() holds known peers whose entry was replaced or whose user data
+// changed, and removed() holds the addresses of peers that left or expired.
+// When full_resync() is true the earlier generation is no longer covered by
+// the change history: added() then holds the complete current table and the
+// caller should discard its mirrored state before applying it.
+class PeerChanges {
+ public:
+  PeerChanges() = default;
+
+  // Generation the caller is up to date with after applying these changes.
+  uint64_t generation() const { return generation_; }
+  void set_generation(uint64_t generation) { generation_ = generation; }
+
+  bool full_resync() const { return full_resync_; }
+  void set_full_resync(bool full_resync) { full_resync_ = full_resync; }
+
+  const std::vector<DiscoveredPeer>& added() const { return added_; }
+  std::vector<DiscoveredPeer>* mutable_added() { return &added_; }
+
+  const std::vector<DiscoveredPeer>& updated() const { return updated_; }
+  std::vector<DiscoveredPeer>* mutable_updated() { return &updated_; }
+
+  const std::vector<IpPort>& removed() const { return removed_; }
+  std::vector<IpPort>* mutable_removed() { return &removed_; }
+
+  bool empty() const { return added_.empty() && updated_.empty() && removed_.empty(); }
+
+ private:
+  uint64_t generation_ = 0;
+  bool full_resync_ = false;
+  std::vector<DiscoveredPeer> added_;
+  std::vector<DiscoveredPeer> updated_;
+  std::vector<IpPort> removed_;
+};
+
+// A bounded queue of PeerEvents delivered by a Peer as they happen.
+//
+// Events are pushed from the Peer's background threads and never block
+// them: when the queue is full further events are dropped and the consumer
+// receives a single kOverflow event once it drains the queue. All methods
+// are thread-safe.
+class PeerSubscription {
+ public:
+  explicit PeerSubscription(size_t max_queued_events);
+
+  PeerSubscription(const PeerSubscription&) = delete;             // Non-copyable.
+  PeerSubscription& operator=(const PeerSubscription&) = delete;  // Non-copyable.
+
+  // Moves all queued events to the end of events_out, waiting up to timeout
+  // for at least one. Returns false once the subscription is closed and
+  // fully drained.
+  bool WaitEvents(std::vector<PeerEvent>& events_out, std::chrono::milliseconds timeout);
+
+  // Moves all queued events to the end of events_out without waiting.
+  // Returns false once the subscription is closed and fully drained.
+  bool TryGetEvents(std::vector<PeerEvent>& events_out);
+
+  // Stops delivery. Called by the consumer to unsubscribe, and by the Peer
+  // when it stops. Wakes any pending WaitEvents().
+  void Close();
+
+  bool closed() const;
+
+  // Queues an event, or drops it if the queue is full. Used by Peer.
+  void Push(PeerEventType type, const DiscoveredPeer& peer);
+
+ private:
+  bool drainLocked(std::vector<PeerEvent>& events_out);
+
+  const size_t max_queued_events_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<PeerEvent> events_;
+  bool overflowed_ = false;
+  bool closed_ = false;
+};
+
+}  // namespace discovery
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+
+#include "discovery_peer.h"
+#include "discovery_peer_parameters.h"
+#include "discovery_peer_stats.h"
+
+namespace discovery {
+
+namespace impl {
+class PeerGroupEnv;
+}  // namespace impl
+
+// Hosts many logical peers in one process on a shared receiving socket and
+// three threads in total (scheduling, socket reader and decoding), instead
+// of one socket and up to three threads per Peer.
+//
+// Every received datagram is decoded once and handed to the members started
+// with its application_id; a single scheduling thread sends the
+// announcements of all members. Each member keeps its own unbound sending
+// socket, since other peers tell peers apart by their source address.
+//
+// Members are started with Peer::Start(PeerGroup&, ...). All public methods
+// are thread-safe after Start() returns successfully.
+class PeerGroup {
+ public:
+  PeerGroup();
+  ~PeerGroup();
+
+  PeerGroup(const PeerGroup&) = delete;             // Non-copyable.
+  PeerGroup& operator=(const PeerGroup&) = delete;  // Non-copyable.
+  PeerGroup(PeerGroup&&) = delete;                  // Non-movable.
+  PeerGroup& operator=(PeerGroup&&) = delete;       // Non-movable.
+
+  // Binds the shared socket to the port of parameters and, if multicast is
+  // enabled in them, joins their multicast group; other fields are ignored.
+  // Stops any previously running group first. Returns false if socket setup
+  // fails.
+  bool Start(const PeerParameters& parameters);
+
+  // Returns the rejection counters of the shared socket. Packets of an
+  // application_id no member listens for count as
+  // rejected_foreign_application().
+  PeerStats GetStats() const;
+
+  // Stops every member and returns immediately. Background threads finish
+  // on their own after the members have sent their departure packets.
+  void Stop();
+
+  // Stops every member and blocks until all background threads exit.
+  void StopAndWaitForThreads();
+
+ private:
+  friend class Peer;
+
+  void StopImpl(bool wait_for_threads);
+
+  std::shared_ptr<impl::PeerGroupEnv> env_;
+  std::unique_ptr<std::thread> scheduling_thread_;
+  std::unique_ptr<std::thread> receiving_thread_;
+};
+
+}  // namespace discovery
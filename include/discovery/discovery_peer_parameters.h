@@ -1,6 +1,7 @@
 #pragma once
 
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
 
 namespace discovery {
@@ -70,6 +71,96 @@ class PeerParameters {
     }
   }
 
+  // Randomizes every announce interval uniformly within
+  // send_timeout * [1 - send_jitter, 1 + send_jitter], so peers started at
+  // the same moment drift apart instead of announcing in lockstep. Clamped
+  // to [0, 1]; 0 disables jitter. Keep send_timeout * (1 + send_jitter)
+  // below the TTL.
+  double send_jitter() const { return send_jitter_; }
+  void set_send_jitter(double jitter) { send_jitter_ = jitter < 0 ? 0 : (jitter > 1 ? 1 : jitter); }
+
+  // When positive, stretches the announce interval as the number of peers
+  // grows, so that a listener receives about max_announce_rate
+  // announcements per second from all peers together: the interval becomes
+  // max(send_timeout, (peers + 1) / max_announce_rate seconds). The TTL of
+  // discovered peers is stretched by the same factor. A peer that can
+  // discover counts the peers it discovered; one that can only be
+  // discovered opens a receiving socket and thread to count the peers it
+  // hears announcing, without keeping their user data. Every peer of an
+  // application should use the same value. 0 disables adaptation.
+  double max_announce_rate() const { return max_announce_rate_; }
+  void set_max_announce_rate(double rate) { max_announce_rate_ = rate > 0 ? rate : 0; }
+
+  // Number of extra announcements sent right after Start(), so a new peer
+  // becomes visible despite lost packets. The first follows after
+  // startup_burst_interval and every further one after twice the previous
+  // interval, until the steady interval is reached. 0 disables the burst.
+  int startup_burst_count() const { return startup_burst_count_; }
+  void set_startup_burst_count(int count) { startup_burst_count_ = count > 0 ? count : 0; }
+
+  std::chrono::milliseconds startup_burst_interval() const { return startup_burst_interval_; }
+  void set_startup_burst_interval(std::chrono::milliseconds interval) {
+    if (interval.count() > 0) {
+      startup_burst_interval_ = interval;
+    }
+  }
+
+  // Convenience overloads accepting raw milliseconds.
+  int64_t startup_burst_interval_ms() const { return startup_burst_interval_.count(); }
+  void set_startup_burst_interval_ms(int64_t interval_ms) {
+    if (interval_ms > 0) {
+      startup_burst_interval_ = std::chrono::milliseconds(interval_ms);
+    }
+  }
+
+  // Minimum time between an announcement and an out-of-schedule resend,
+  // as triggered by Peer::SetUserData() or a user data request. Changes
+  // made within this time are coalesced into one resend at its end.
+  std::chrono::milliseconds min_resend_interval() const { return min_resend_interval_; }
+  void set_min_resend_interval(std::chrono::milliseconds interval) {
+    if (interval.count() >= 0) {
+      min_resend_interval_ = interval;
+    }
+  }
+
+  // Convenience overloads accepting raw milliseconds.
+  int64_t min_resend_interval_ms() const { return min_resend_interval_.count(); }
+  void set_min_resend_interval_ms(int64_t interval_ms) {
+    if (interval_ms >= 0) {
+      min_resend_interval_ = std::chrono::milliseconds(interval_ms);
+    }
+  }
+
+  // When enabled, a peer that can discover broadcasts a query on Start()
+  // instead of waiting a full send interval to learn the population, and a
+  // peer that can be discovered answers queries with a full announcement
+  // after a random delay. The delay is spread over the time the population
+  // needs to answer at max_announce_rate, or at 1000 responses per second
+  // if that is not set, but is at least query_response_delay and at most
+  // the announce interval. A response is skipped if a full announcement
+  // went out after the query arrived, and queries arriving while a response
+  // is pending share it. A peer that can be discovered but not discover
+  // opens a receiving socket and thread to hear queries and to count the
+  // peers it hears announcing, which sizes its delay window. Enabled by
+  // default.
+  bool use_queries() const { return use_queries_; }
+  void set_use_queries(bool use_queries) { use_queries_ = use_queries; }
+
+  std::chrono::milliseconds query_response_delay() const { return query_response_delay_; }
+  void set_query_response_delay(std::chrono::milliseconds delay) {
+    if (delay.count() >= 0) {
+      query_response_delay_ = delay;
+    }
+  }
+
+  // Convenience overloads accepting raw milliseconds.
+  int64_t query_response_delay_ms() const { return query_response_delay_.count(); }
+  void set_query_response_delay_ms(int64_t delay_ms) {
+    if (delay_ms >= 0) {
+      query_response_delay_ = std::chrono::milliseconds(delay_ms);
+    }
+  }
+
   bool can_be_discovered() const { return can_be_discovered_; }
   void set_can_be_discovered(bool can_be_discovered) { can_be_discovered_ = can_be_discovered; }
 
@@ -82,6 +173,35 @@ class PeerParameters {
   SamePeerMode same_peer_mode() const { return same_peer_mode_; }
   void set_same_peer_mode(SamePeerMode same_peer_mode) { same_peer_mode_ = same_peer_mode; }
 
+  // When enabled, periodic announcements carry only a digest of the user
+  // data; the full user data is sent when it changes and when another peer
+  // requests it. The peer falls back to full announcements while it hears
+  // announcements from peers that predate heartbeats, and always when it
+  // cannot discover (requests would not reach it). Listen-only peers of
+  // older versions are not detected, so enable this only when every
+  // listener supports heartbeats or announces itself.
+  bool use_heartbeats() const { return use_heartbeats_; }
+  void set_use_heartbeats(bool use_heartbeats) { use_heartbeats_ = use_heartbeats; }
+
+  // When enabled, user data of at least compression_threshold bytes is sent
+  // compressed if that makes it smaller. Like heartbeats, compression is
+  // suspended while peers that predate it are heard, and never used by
+  // peers that cannot discover.
+  bool use_compression() const { return use_compression_; }
+  void set_use_compression(bool use_compression) { use_compression_ = use_compression; }
+
+  size_t compression_threshold() const { return compression_threshold_; }
+  void set_compression_threshold(size_t threshold) { compression_threshold_ = threshold; }
+
+  // When enabled (the default), the receiving socket gets a kernel filter
+  // on Linux that drops datagrams whose fixed header is invalid or names
+  // another application_id before they reach the peer. The rejected_*()
+  // counters of PeerStats then miss those datagrams; disable the filter to
+  // count every one. A PeerGroup takes this from the parameters it is
+  // started with and filters on the header only.
+  bool use_socket_filter() const { return use_socket_filter_; }
+  void set_use_socket_filter(bool use_socket_filter) { use_socket_filter_ = use_socket_filter; }
+
  private:
   uint32_t application_id_ = 0;
   bool can_use_broadcast_ = true;
@@ -90,10 +210,21 @@ class PeerParameters {
   uint32_t multicast_group_address_ = 0;
   std::chrono::milliseconds send_timeout_{5000};
   std::chrono::milliseconds discovered_peer_ttl_{10000};
+  double send_jitter_ = 0;
+  double max_announce_rate_ = 0;
+  int startup_burst_count_ = 0;
+  std::chrono::milliseconds startup_burst_interval_{100};
+  std::chrono::milliseconds min_resend_interval_{50};
+  bool use_queries_ = true;
+  std::chrono::milliseconds query_response_delay_{20};
   bool can_be_discovered_ = false;
   bool can_discover_ = false;
   bool discover_self_ = false;
   SamePeerMode same_peer_mode_ = SamePeerMode::kIpAndPort;
+  bool use_heartbeats_ = false;
+  bool use_compression_ = false;
+  size_t compression_threshold_ = 256;
+  bool use_socket_filter_ = true;
 };
 
 }  // namespace discovery
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace discovery {
+
+// Distribution of durations over power-of-two microsecond buckets: bucket 0
+// counts durations below 1 us, bucket i > 0 those in [2^(i-1), 2^i) us, and
+// the last bucket also everything longer.
+class LatencyHistogram {
+ public:
+  static constexpr size_t kBucketCount = 24;
+
+  LatencyHistogram() = default;
+
+  uint64_t bucket(size_t index) const { return buckets_[index]; }
+  void set_bucket(size_t index, uint64_t count) { buckets_[index] = count; }
+
+  // Returns the exclusive upper bound of bucket index in microseconds.
+  static uint64_t BucketUpperBoundUs(size_t index) { return uint64_t{1} << index; }
+
+  // Returns the number of recorded durations.
+  uint64_t count() const {
+    uint64_t total = 0;
+    for (uint64_t bucket_count : buckets_) {
+      total += bucket_count;
+    }
+    return total;
+  }
+
+  // Returns the upper bound of the bucket that holds the given quantile
+  // (0 to 1) of the recorded durations, or 0 if none were recorded.
+  uint64_t QuantileUpperBoundUs(double quantile) const {
+    uint64_t total = count();
+    if (total == 0) {
+      return 0;
+    }
+    auto rank = static_cast<uint64_t>(quantile * static_cast<double>(total - 1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; ++i) {
+      seen += buckets_[i];
+      if (seen > rank) {
+        return BucketUpperBoundUs(i);
+      }
+    }
+    return BucketUpperBoundUs(kBucketCount - 1);
+  }
+
+ private:
+  std::array<uint64_t, kBucketCount> buckets_{};
+};
+
+// Counters describing the traffic seen by a Peer, as returned by
+// Peer::GetStats(). Values are cumulative since Start(), except
+// table_size(). For a member of a PeerGroup the receive-side values
+// (packets_received() through the rejected_*() counters but rejected_self(),
+// the receive_queue_*() values and receive_batch_time()) describe the
+// group's shared socket.
+class PeerStats {
+ public:
+  PeerStats() = default;
+
+  // Datagrams read from the socket.
+  uint64_t packets_received() const { return packets_received_; }
+  void set_packets_received(uint64_t value) { packets_received_ = value; }
+
+  // Complete, valid packets produced from them; a fragmented announcement
+  // counts once, when its last fragment arrives.
+  uint64_t packets_accepted() const { return packets_accepted_; }
+  void set_packets_accepted(uint64_t value) { packets_accepted_ = value; }
+
+  // Datagrams shorter than the fixed packet header.
+  uint64_t rejected_truncated() const { return rejected_truncated_; }
+  void set_rejected_truncated(uint64_t value) { rejected_truncated_ = value; }
+
+  // Datagrams that do not start with the "DSCV" magic.
+  uint64_t rejected_bad_magic() const { return rejected_bad_magic_; }
+  void set_rejected_bad_magic(uint64_t value) { rejected_bad_magic_ = value; }
+
+  // Packets of an unsupported protocol version.
+  uint64_t rejected_bad_version() const { return rejected_bad_version_; }
+  void set_rejected_bad_version(uint64_t value) { rejected_bad_version_ = value; }
+
+  // Packets of an unknown packet type.
+  uint64_t rejected_bad_type() const { return rejected_bad_type_; }
+  void set_rejected_bad_type(uint64_t value) { rejected_bad_type_ = value; }
+
+  // Packets addressed to a different application_id.
+  uint64_t rejected_foreign_application() const { return rejected_foreign_application_; }
+  void set_rejected_foreign_application(uint64_t value) { rejected_foreign_application_ = value; }
+
+  // Packets with a valid header but an oversized or inconsistent payload.
+  uint64_t rejected_malformed() const { return rejected_malformed_; }
+  void set_rejected_malformed(uint64_t value) { rejected_malformed_ = value; }
+
+  // Datagrams larger than the receive buffer, which the socket cut short.
+  uint64_t rejected_oversized() const { return rejected_oversized_; }
+  void set_rejected_oversized(uint64_t value) { rejected_oversized_ = value; }
+
+  // Packets sent by this peer itself, dropped unless discover_self() is set.
+  uint64_t rejected_self() const { return rejected_self_; }
+  void set_rejected_self(uint64_t value) { rejected_self_ = value; }
+
+  // Sum of all rejection counters.
+  uint64_t packets_rejected() const {
+    return rejected_truncated_ + rejected_bad_magic_ + rejected_bad_version_ + rejected_bad_type_ +
+           rejected_foreign_application_ + rejected_malformed_ + rejected_oversized_ + rejected_self_;
+  }
+
+  // Datagrams handed to the socket, counted once per destination, and
+  // those the socket refused.
+  uint64_t packets_sent() const { return packets_sent_; }
+  void set_packets_sent(uint64_t value) { packets_sent_ = value; }
+
+  uint64_t send_failures() const { return send_failures_; }
+  void set_send_failures(uint64_t value) { send_failures_ = value; }
+
+  // Discovered peer changes, matching the PeerEventType of each.
+  uint64_t peers_joined() const { return peers_joined_; }
+  void set_peers_joined(uint64_t value) { peers_joined_ = value; }
+
+  uint64_t peers_updated() const { return peers_updated_; }
+  void set_peers_updated(uint64_t value) { peers_updated_ = value; }
+
+  uint64_t peers_left() const { return peers_left_; }
+  void set_peers_left(uint64_t value) { peers_left_ = value; }
+
+  uint64_t peers_expired() const { return peers_expired_; }
+  void set_peers_expired(uint64_t value) { peers_expired_ = value; }
+
+  // Number of currently discovered peers.
+  uint64_t table_size() const { return table_size_; }
+  void set_table_size(uint64_t value) { table_size_ = value; }
+
+  // Datagrams drained from the socket but dropped because the queue to the
+  // decoding stage was full. They are not counted in packets_received().
+  uint64_t receive_queue_overflows() const { return receive_queue_overflows_; }
+  void set_receive_queue_overflows(uint64_t value) { receive_queue_overflows_ = value; }
+
+  // Largest number of datagrams seen waiting for the decoding stage.
+  uint64_t receive_queue_depth_max() const { return receive_queue_depth_max_; }
+  void set_receive_queue_depth_max(uint64_t value) { receive_queue_depth_max_ = value; }
+
+  // Time spent decoding and applying each batch of received datagrams.
+  const LatencyHistogram& receive_batch_time() const { return receive_batch_time_; }
+  LatencyHistogram* mutable_receive_batch_time() { return &receive_batch_time_; }
+
+  // Time the peer's state lock is held to apply received packets or to
+  // expire idle peers.
+  const LatencyHistogram& lock_hold_time() const { return lock_hold_time_; }
+  LatencyHistogram* mutable_lock_hold_time() { return &lock_hold_time_; }
+
+ private:
+  uint64_t packets_received_ = 0;
+  uint64_t packets_accepted_ = 0;
+  uint64_t rejected_truncated_ = 0;
+  uint64_t rejected_bad_magic_ = 0;
+  uint64_t rejected_bad_version_ = 0;
+  uint64_t rejected_bad_type_ = 0;
+  uint64_t rejected_foreign_application_ = 0;
+  uint64_t rejected_malformed_ = 0;
+  uint64_t rejected_oversized_ = 0;
+  uint64_t rejected_self_ = 0;
+  uint64_t packets_sent_ = 0;
+  uint64_t send_failures_ = 0;
+  uint64_t peers_joined_ = 0;
+  uint64_t peers_updated_ = 0;
+  uint64_t peers_left_ = 0;
+  uint64_t peers_expired_ = 0;
+  uint64_t table_size_ = 0;
+  uint64_t receive_queue_overflows_ = 0;
+  uint64_t receive_queue_depth_max_ = 0;
+  LatencyHistogram receive_batch_time_;
+  LatencyHistogram lock_hold_time_;
+};
+
+}  // namespace discovery
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace discovery {
 
@@ -40,6 +43,14 @@ class BufferView {
     return c;
   }
 
+  // Returns a pointer to the next num_bytes bytes and skips them. The caller
+  // must check CanRead(num_bytes) first.
+  const char* ReadBytes(size_t num_bytes) {
+    const char* bytes = (write_buffer_ ? write_buffer_->data() : read_data_) + parsed_;
+    parsed_ += num_bytes;
+    return bytes;
+  }
+
  private:
   std::string* write_buffer_ = nullptr;
   const char* read_data_ = nullptr;
@@ -87,23 +98,168 @@ bool SerializeString(SerializeDirection direction, std::string* value, size_t va
 // Maximum number of bytes allowed in the user_data payload.
 constexpr size_t kMaxUserDataSize = 4096;
 
+// Maximum user data a Peer can announce. Payloads that do not fit a single
+// packet are split into kIAmHereFragment packets.
+constexpr size_t kMaxLargeUserDataSize = 60 * 1024;
+
+// Size of the fixed packet header that precedes user_data on the wire.
+constexpr size_t kPacketHeaderSize = 27;
+
+// Largest datagram a valid packet can occupy.
+constexpr size_t kMaxDatagramSize = kPacketHeaderSize + kMaxUserDataSize;
+
 // Maximum UDP datagram size used for the receive buffer.
 constexpr size_t kMaxPacketSize = 65536;
 
-enum class PacketType : uint8_t { kIAmHere = 0, kIAmOutOfHere = 1, kUnknown = 255 };
+// kIAmHere carries the full user data. kHeartbeat is a digest-only
+// announcement whose payload is the kHeartbeatPayloadSize-byte digest of the
+// sender's user data; a receiver that does not hold matching user data
+// broadcasts a kUserDataRequest, whose kUserDataRequestPayloadSize-byte
+// payload names the peer_id that should announce its user data in full.
+// User data too large for one kIAmHere is sent as kIAmHereFragment packets
+// sharing one snapshot_index, each prefixed by a kFragmentHeaderSize-byte
+// fragment header. A kQuery, with an empty payload, asks every
+// discoverable peer to announce itself after a short random delay.
+enum class PacketType : uint8_t {
+  kIAmHere = 0,
+  kIAmOutOfHere = 1,
+  kHeartbeat = 2,
+  kUserDataRequest = 3,
+  kIAmHereFragment = 4,
+  kQuery = 5,
+  kUnknown = 255
+};
 
 constexpr PacketType kPacketIAmHere = PacketType::kIAmHere;
 constexpr PacketType kPacketIAmOutOfHere = PacketType::kIAmOutOfHere;
+constexpr PacketType kPacketHeartbeat = PacketType::kHeartbeat;
+constexpr PacketType kPacketUserDataRequest = PacketType::kUserDataRequest;
+constexpr PacketType kPacketIAmHereFragment = PacketType::kIAmHereFragment;
+constexpr PacketType kPacketQuery = PacketType::kQuery;
 constexpr PacketType kPacketTypeUnknown = PacketType::kUnknown;
 
+constexpr size_t kHeartbeatPayloadSize = 8;
+constexpr size_t kUserDataRequestPayloadSize = 4;
+
+// Fragment header: big-endian 16-bit size of the whole payload, then the
+// 8-bit index and count of fragments. Every fragment but the last carries
+// exactly kMaxFragmentDataSize payload bytes.
+constexpr size_t kFragmentHeaderSize = 4;
+constexpr size_t kMaxFragmentDataSize = kMaxUserDataSize - kFragmentHeaderSize;
+constexpr size_t kMaxFragmentCount = (kMaxLargeUserDataSize + kMaxFragmentDataSize - 1) / kMaxFragmentDataSize;
+
+// Header flag set by senders that understand kHeartbeat, kUserDataRequest,
+// kQuery and kPacketFlagCompressed. Peers built before these extensions leave the
+// flags byte zero, drop the new packet types as unknown and would take a
+// compressed payload for user data.
+constexpr uint8_t kPacketFlagExtensionsAware = 0x01;
+
+// Header flag marking a kIAmHere payload as compressed user data; see
+// PacketView::Decompress().
+constexpr uint8_t kPacketFlagCompressed = 0x02;
+
 namespace impl {
+
 PacketType GetPacketType(uint8_t packet_type);
+
+// Magic bytes and protocol version at the start of every packet.
+constexpr char kPacketMagic[4] = {'D', 'S', 'C', 'V'};
+constexpr uint8_t kProtocolVersion = 1;
+
+// Byte offsets of the fixed header fields. All multi-byte fields are
+// big-endian.
+constexpr size_t kMagicOffset = 0;
+constexpr size_t kVersionOffset = 4;
+constexpr size_t kFlagsOffset = 5;
+constexpr size_t kReservedOffset = 6;
+constexpr size_t kPacketTypeOffset = 8;
+constexpr size_t kApplicationIdOffset = 9;
+constexpr size_t kPeerIdOffset = 13;
+constexpr size_t kSnapshotIndexOffset = 17;
+constexpr size_t kUserDataSizeOffset = 25;
+
+static_assert(kUserDataSizeOffset + sizeof(uint16_t) == kPacketHeaderSize, "header layout out of sync");
+
+inline uint8_t ByteSwap(uint8_t value) { return value; }
+
+inline uint16_t ByteSwap(uint16_t value) { return static_cast<uint16_t>((value >> 8) | (value << 8)); }
+
+inline uint32_t ByteSwap(uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_bswap32(value);
+#else
+  return ((value & 0x000000ffu) << 24) | ((value & 0x0000ff00u) << 8) | ((value & 0x00ff0000u) >> 8) |
+         ((value & 0xff000000u) >> 24);
+#endif
+}
+
+inline uint64_t ByteSwap(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_bswap64(value);
+#else
+  return (static_cast<uint64_t>(ByteSwap(static_cast<uint32_t>(value))) << 32) |
+         ByteSwap(static_cast<uint32_t>(value >> 32));
+#endif
+}
+
+// Converts between host and big-endian (network) byte order.
+template <typename ValueType>
+ValueType HostToBigEndian(ValueType value) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return value;
+#else
+  return ByteSwap(value);
+#endif
+}
+
+// Stores value big-endian at data with a single unaligned store.
+template <typename ValueType>
+void StoreBigEndian(char* data, ValueType value) {
+  value = HostToBigEndian(value);
+  std::memcpy(data, &value, sizeof(value));
+}
+
+// Loads a big-endian value from data with a single unaligned load.
+template <typename ValueType>
+ValueType LoadBigEndian(const char* data) {
+  ValueType value;
+  std::memcpy(&value, data, sizeof(value));
+  return HostToBigEndian(value);
+}
+
+// Decoded fixed packet header.
+struct PacketHeader {
+  uint8_t flags = 0;
+  uint8_t packet_type = 0;
+  uint32_t application_id = 0;
+  uint32_t peer_id = 0;
+  uint64_t snapshot_index = 0;
+  uint16_t user_data_size = 0;
+};
+
+// Writes the kPacketHeaderSize header bytes, magic and version included, to
+// data.
+void EncodePacketHeader(const PacketHeader& header, char* data);
+
+// Reads the header at the start of data. Returns false if data is shorter
+// than the header or the magic, version or packet type is not valid; the
+// payload length is not checked.
+bool DecodePacketHeader(const char* data, size_t size, PacketHeader* header);
+
+// Returns the digest of user_data carried by kHeartbeat packets (64-bit
+// FNV-1a).
+uint64_t UserDataDigest(std::string_view user_data);
+
+// Encode the payloads of kHeartbeat and kUserDataRequest packets.
+std::string MakeHeartbeatPayload(uint64_t user_data_digest);
+std::string MakeUserDataRequestPayload(uint32_t peer_id);
+
 }  // namespace impl
 
 // Represents a single discovery protocol packet.
 //
 // Supports binary serialization (Serialize) and deserialization (Parse).
-// The wire format uses magic bytes "SO7V" followed by a version byte and
+// The wire format uses magic bytes "DSCV" followed by a version byte and
 // fixed-size header fields, with a variable-length user data payload.
 class Packet {
  public:
@@ -112,6 +268,10 @@ class Packet {
   PacketType packet_type() const { return static_cast<PacketType>(packet_type_); }
   void set_packet_type(PacketType packet_type) { packet_type_ = static_cast<uint8_t>(packet_type); }
 
+  // Bitwise OR of kPacketFlag* values.
+  uint8_t flags() const { return flags_; }
+  void set_flags(uint8_t flags) { flags_ = flags; }
+
   uint32_t application_id() const { return application_id_; }
   void set_application_id(uint32_t application_id) { application_id_ = application_id; }
 
@@ -129,13 +289,17 @@ class Packet {
   // exceeds kMaxUserDataSize or another serialization error occurs.
   bool Serialize(std::string& buffer_out);
 
-  // Parses buffer into this packet. Returns false if the buffer does not
-  // contain a valid packet (wrong magic, unknown version, truncated data).
+  // Parses buffer into this packet, decompressing a compressed payload.
+  // Returns false if the buffer does not contain a valid packet (wrong
+  // magic, unknown version, truncated or corrupt data).
   bool Parse(const std::string& buffer);
 
- private:
-  bool SerializeBody(impl::SerializeDirection direction, impl::BufferView* buffer_view);
+  // Same as above over a raw byte range. Reuses the capacity of user_data,
+  // so parsing repeatedly into one Packet does not allocate.
+  bool Parse(const char* data, size_t size);
 
+ private:
+  uint8_t flags_ = 0;
   uint8_t packet_type_ = 0;
   uint32_t application_id_ = 0;
   uint32_t peer_id_ = 0;
@@ -143,4 +307,130 @@ class Packet {
   std::string user_data_;
 };
 
+// A non-owning, read-only view of a packet held in a caller-provided buffer.
+//
+// Parse() validates the header in place and user_data() points into the
+// buffer, so no payload bytes are copied. The view is valid only as long as
+// the underlying buffer is neither modified nor freed.
+class PacketView {
+ public:
+  PacketView() = default;
+
+  PacketType packet_type() const { return packet_type_; }
+  uint8_t flags() const { return flags_; }
+  uint32_t application_id() const { return application_id_; }
+  uint32_t peer_id() const { return peer_id_; }
+  uint64_t snapshot_index() const { return snapshot_index_; }
+  std::string_view user_data() const { return user_data_; }
+
+  // Payload of a kHeartbeat packet.
+  uint64_t user_data_digest() const { return impl::LoadBigEndian<uint64_t>(user_data_.data()); }
+
+  // Payload of a kUserDataRequest packet.
+  uint32_t requested_peer_id() const { return impl::LoadBigEndian<uint32_t>(user_data_.data()); }
+
+  // Fragment header and data of a kIAmHereFragment packet.
+  size_t fragmented_size() const { return impl::LoadBigEndian<uint16_t>(user_data_.data()); }
+  size_t fragment_index() const { return static_cast<uint8_t>(user_data_[2]); }
+  size_t fragment_count() const { return static_cast<uint8_t>(user_data_[3]); }
+  std::string_view fragment_data() const { return user_data_.substr(kFragmentHeaderSize); }
+
+  // Turns this kIAmHereFragment view into the kIAmHere packet carried by
+  // its fragment set, whose reassembled payload is user_data. user_data must
+  // outlive the view.
+  void SetReassembled(std::string_view user_data) {
+    packet_type_ = PacketType::kIAmHere;
+    user_data_ = user_data;
+  }
+
+  bool compressed() const { return (flags_ & kPacketFlagCompressed) != 0; }
+
+  // If the payload is compressed, decompresses it into scratch, whose
+  // capacity is reused, and points user_data() at scratch. Returns false if
+  // the payload is corrupt or expands beyond kMaxLargeUserDataSize.
+  bool Decompress(std::string* scratch);
+
+  // Points this view at the packet in data. Returns false, leaving the view
+  // unspecified, if data does not hold exactly one valid packet.
+  bool Parse(const char* data, size_t size);
+
+ private:
+  PacketType packet_type_ = PacketType::kUnknown;
+  uint8_t flags_ = 0;
+  uint32_t application_id_ = 0;
+  uint32_t peer_id_ = 0;
+  uint64_t snapshot_index_ = 0;
+  std::string_view user_data_;
+};
+
+namespace impl {
+// Serializes payload, up to kMaxLargeUserDataSize bytes, as a sequence of
+// kIAmHereFragment packets that copy the remaining header fields from
+// packet, replacing the contents of frames. Returns false if payload is too
+// large.
+bool SerializeFragments(const Packet& packet, std::string_view payload, std::vector<std::string>* frames);
+
+// Rewrites the packet type and snapshot index of an already serialized
+// packet in place. Returns false if buffer is too short to hold a header.
+bool PatchPacketHeader(std::string* buffer, PacketType packet_type, uint64_t snapshot_index);
+
+// Outcome of PacketPrefilter::Check().
+enum class PrefilterVerdict {
+  kAccept,
+  kTruncated,
+  kBadMagic,
+  kBadVersion,
+  kBadType,
+  kForeignApplication,
+};
+
+// Cheap first-stage filter for received datagrams.
+//
+// Checks the magic, version, packet type and application_id with a few
+// fixed-offset loads against precomputed wire values, so traffic of other
+// protocols and applications sharing the port is dropped before any parsing
+// or copying. Accepted datagrams still need a full PacketView::Parse().
+class PacketPrefilter {
+ public:
+  // Accepts packets of any application.
+  PacketPrefilter() : magic_word_(LoadWord(kPacketMagic)), application_word_(0), any_application_(true) {}
+
+  explicit PacketPrefilter(uint32_t application_id)
+      : magic_word_(LoadWord(kPacketMagic)), application_word_(HostToBigEndian(application_id)) {}
+
+  PrefilterVerdict Check(const char* data, size_t size) const {
+    if (size < kPacketHeaderSize) {
+      return PrefilterVerdict::kTruncated;
+    }
+    if (LoadWord(data + kMagicOffset) != magic_word_) {
+      return PrefilterVerdict::kBadMagic;
+    }
+    if (static_cast<uint8_t>(data[kVersionOffset]) != kProtocolVersion) {
+      return PrefilterVerdict::kBadVersion;
+    }
+    if (GetPacketType(static_cast<uint8_t>(data[kPacketTypeOffset])) == kPacketTypeUnknown) {
+      return PrefilterVerdict::kBadType;
+    }
+    if (!any_application_ && LoadWord(data + kApplicationIdOffset) != application_word_) {
+      return PrefilterVerdict::kForeignApplication;
+    }
+    return PrefilterVerdict::kAccept;
+  }
+
+ private:
+  // Loads four bytes in native byte order; the expected words are prepared
+  // in the same order, so no byte swapping happens per datagram.
+  static uint32_t LoadWord(const char* data) {
+    uint32_t word;
+    std::memcpy(&word, data, sizeof(word));
+    return word;
+  }
+
+  uint32_t magic_word_;
+  uint32_t application_word_;
+  bool any_application_ = false;
+};
+
+}  // namespace impl
+
 }  // namespace discovery
@@ -0,0 +1,63 @@
+#include "discovery_change_log.h"
+
+#include <unordered_map>
+
+namespace discovery {
+namespace impl {
+
+ChangeLog::ChangeLog(size_t max_records) : max_records_(max_records) {}
+
+void ChangeLog::Restart(uint32_t epoch) {
+  generation_ = static_cast<uint64_t>(epoch) << kEpochShift;
+  changes_.clear();
+}
+
+void ChangeLog::Record(PeerEventType type, const IpPort& ip_port) {
+  ++generation_;
+  changes_.push_back(Change{type, ip_port});
+  if (changes_.size() > max_records_) {
+    changes_.pop_front();
+  }
+}
+
+void ChangeLog::Collect(uint64_t since, PeerTable& table, PeerChanges& changes_out) const {
+  changes_out = PeerChanges();
+  changes_out.set_generation(generation_);
+
+  uint64_t oldest_covered = generation_ - changes_.size();
+  if (since > generation_ || since < oldest_covered) {
+    changes_out.set_full_resync(true);
+    changes_out.mutable_added()->assign(table.peers().begin(), table.peers().end());
+    return;
+  }
+
+  // The first change to an entry after since tells whether it existed then;
+  // whether it exists now decides between added, updated and removed.
+  struct Touched {
+    bool existed;
+    IpPort ip_port;
+  };
+  std::unordered_map<uint64_t, Touched> touched;
+  for (size_t i = static_cast<size_t>(since - oldest_covered); i < changes_.size(); ++i) {
+    const Change& change = changes_[i];
+    auto inserted =
+        touched.emplace(table.KeyOf(change.ip_port), Touched{change.type != PeerEventType::kJoined, change.ip_port});
+    inserted.first->second.ip_port = change.ip_port;
+  }
+
+  for (const auto& entry : touched) {
+    const DiscoveredPeer* peer = table.Find(entry.second.ip_port);
+    if (peer == nullptr) {
+      if (entry.second.existed) {
+        changes_out.mutable_removed()->push_back(entry.second.ip_port);
+      }
+    } else if (entry.second.existed) {
+      changes_out.mutable_updated()->push_back(*peer);
+    } else {
+      changes_out.mutable_added()->push_back(*peer);
+    }
+  }
+}
+
+}  // namespace impl
+}  // namespace discovery
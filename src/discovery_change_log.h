@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+#include "discovery/discovery_ip_port.h"
+#include "discovery/discovery_peer_events.h"
+#include "discovery_peer_table.h"
+
+namespace discovery {
+namespace impl {
+
+// Bounded history of changes to a PeerTable, numbered by a monotonically
+// increasing generation.
+//
+// Generations start at a base set by Restart(); the random upper bits of the
+// base tell runs apart, so that a generation saved during an earlier run
+// forces a full resync instead of being mistaken for one of this run.
+//
+// Every membership or user data change is recorded as one generation, so
+// Collect() can report what changed since a given generation in time
+// proportional to the number of changes rather than the table size. Only
+// the most recent max_records changes are retained; older generations force
+// a full resync.
+//
+// Not thread-safe; callers serialize access together with the PeerTable.
+class ChangeLog {
+ public:
+  static constexpr size_t kDefaultMaxRecords = 65536;
+
+  // Number of low bits of a generation left for counting changes; the bits
+  // above are the epoch passed to Restart().
+  static constexpr int kEpochShift = 40;
+
+  explicit ChangeLog(size_t max_records = kDefaultMaxRecords);
+
+  // Generation of the most recent change, or the base generation if nothing
+  // has changed since Restart().
+  uint64_t generation() const { return generation_; }
+
+  // Forgets all changes and numbers the following ones from a base
+  // generation of epoch << kEpochShift. epoch must be non-zero so that the
+  // generation 0 callers start with is never covered.
+  void Restart(uint32_t epoch);
+
+  // Records a change to the entry identified by ip_port.
+  void Record(PeerEventType type, const IpPort& ip_port);
+
+  // Fills changes_out with the difference between the table as of
+  // generation since and its current state.
+  void Collect(uint64_t since, PeerTable& table, PeerChanges& changes_out) const;
+
+ private:
+  struct Change {
+    PeerEventType type;
+    IpPort ip_port;
+  };
+
+  size_t max_records_;
+  uint64_t generation_ = 0;
+  // Changes numbered generation_ - changes_.size() + 1 through generation_.
+  std::deque<Change> changes_;
+};
+
+}  // namespace impl
+}  // namespace discovery
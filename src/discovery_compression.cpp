@@ -0,0 +1,190 @@
+#include "discovery_compression.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+#include "discovery/discovery_protocol.h"
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+constexpr size_t kSizePrefix = 2;
+constexpr size_t kMaxInputSize = 0xffff;
+constexpr size_t kMaxOffset = 0xffff;
+constexpr int kHashBits = 12;
+constexpr uint32_t kNoPosition = UINT32_MAX;
+
+uint32_t Load32(const char* data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint32_t HashOf(uint32_t sequence) { return (sequence * 2654435761u) >> (32 - kHashBits); }
+
+// Appends the part of a length that does not fit its 4-bit token nibble.
+void PutExtendedLength(size_t length, std::string* out) {
+  length -= 15;
+  while (length >= 255) {
+    out->push_back(static_cast<char>(255));
+    length -= 255;
+  }
+  out->push_back(static_cast<char>(length));
+}
+
+// Reads an extended length started by a saturated nibble. Returns false if
+// the input ends or the length exceeds limit.
+bool GetExtendedLength(std::string_view in, size_t* pos, size_t limit, size_t* length) {
+  while (true) {
+    if (*pos >= in.size()) {
+      return false;
+    }
+    auto byte = static_cast<uint8_t>(in[(*pos)++]);
+    *length += byte;
+    if (*length > limit) {
+      return false;
+    }
+    if (byte != 255) {
+      return true;
+    }
+  }
+}
+
+void PutSequence(const char* literals, size_t literal_length, size_t offset, size_t match_length,
+                 std::string* out) {
+  size_t match_code = match_length == 0 ? 0 : match_length - kMinMatch;
+  auto token = static_cast<uint8_t>((std::min<size_t>(literal_length, 15) << 4) | std::min<size_t>(match_code, 15));
+  out->push_back(static_cast<char>(token));
+  if (literal_length >= 15) {
+    PutExtendedLength(literal_length, out);
+  }
+  out->append(literals, literal_length);
+  if (match_length == 0) {
+    return;
+  }
+  out->push_back(static_cast<char>(offset & 0xff));
+  out->push_back(static_cast<char>(offset >> 8));
+  if (match_code >= 15) {
+    PutExtendedLength(match_code, out);
+  }
+}
+
+}  // namespace
+
+namespace discovery {
+namespace impl {
+
+bool CompressPayload(std::string_view data, std::string* out) {
+  const size_t size = data.size();
+  if (size > kMaxInputSize) {
+    return false;
+  }
+
+  out->clear();
+  out->resize(kSizePrefix);
+  StoreBigEndian(&(*out)[0], static_cast<uint16_t>(size));
+
+  uint32_t table[1 << kHashBits];
+  std::fill(std::begin(table), std::end(table), kNoPosition);
+
+  const char* src = data.data();
+  size_t anchor = 0;
+  size_t pos = 0;
+  while (pos + kMinMatch <= size) {
+    uint32_t sequence = Load32(src + pos);
+    uint32_t& slot = table[HashOf(sequence)];
+    uint32_t candidate = slot;
+    slot = static_cast<uint32_t>(pos);
+
+    if (candidate == kNoPosition || pos - candidate > kMaxOffset || Load32(src + candidate) != sequence) {
+      ++pos;
+      continue;
+    }
+
+    size_t match_length = kMinMatch;
+    while (pos + match_length < size && src[candidate + match_length] == src[pos + match_length]) {
+      ++match_length;
+    }
+    PutSequence(src + anchor, pos - anchor, pos - candidate, match_length, out);
+    pos += match_length;
+    anchor = pos;
+
+    // Give up as soon as compression cannot pay off.
+    if (out->size() >= size) {
+      return false;
+    }
+  }
+  PutSequence(src + anchor, size - anchor, 0, 0, out);
+  return out->size() < size;
+}
+
+bool DecompressPayload(std::string_view compressed, size_t max_size, std::string* out) {
+  if (compressed.size() < kSizePrefix) {
+    return false;
+  }
+  size_t size = LoadBigEndian<uint16_t>(compressed.data());
+  if (size > max_size) {
+    return false;
+  }
+
+  out->resize(size);
+  char* dst = &(*out)[0];
+  size_t in = kSizePrefix;
+  size_t written = 0;
+  while (true) {
+    if (in >= compressed.size()) {
+      return false;
+    }
+    auto token = static_cast<uint8_t>(compressed[in++]);
+
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && !GetExtendedLength(compressed, &in, size, &literal_length)) {
+      return false;
+    }
+    if (literal_length > compressed.size() - in || literal_length > size - written) {
+      return false;
+    }
+    std::memcpy(dst + written, compressed.data() + in, literal_length);
+    in += literal_length;
+    written += literal_length;
+
+    if (in == compressed.size()) {
+      return written == size;
+    }
+
+    if (compressed.size() - in < 2) {
+      return false;
+    }
+    size_t offset = static_cast<uint8_t>(compressed[in]) |
+                    (static_cast<size_t>(static_cast<uint8_t>(compressed[in + 1])) << 8);
+    in += 2;
+    if (offset == 0 || offset > written) {
+      return false;
+    }
+
+    size_t match_length = token & 0x0f;
+    if (match_length == 15 && !GetExtendedLength(compressed, &in, size, &match_length)) {
+      return false;
+    }
+    match_length += kMinMatch;
+    if (match_length > size - written) {
+      return false;
+    }
+
+    // Matches may overlap the bytes they produce, so copy forward.
+    const char* from = dst + written - offset;
+    if (offset >= match_length) {
+      std::memcpy(dst + written, from, match_length);
+    } else {
+      for (size_t i = 0; i < match_length; ++i) {
+        dst[written + i] = from[i];
+      }
+    }
+    written += match_length;
+  }
+}
+
+}  // namespace impl
+}  // namespace discovery
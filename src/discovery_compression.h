@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace discovery {
+namespace impl {
+
+// Dependency-free LZ77 codec for user data payloads.
+//
+// The compressed form is a 2-byte big-endian uncompressed size followed by
+// LZ4-style sequences: a token byte holding the literal length (high nibble)
+// and match length minus four (low nibble), extended by runs of 255-valued
+// bytes when a nibble is saturated, the literals, and a 2-byte little-endian
+// match offset. The final sequence has literals only.
+
+// Compresses data into out. Returns false, leaving out unspecified, if data
+// is longer than 65535 bytes or the compressed form would not be smaller.
+bool CompressPayload(std::string_view data, std::string* out);
+
+// Decompresses compressed into out, reusing its capacity. Returns false if
+// compressed is corrupt or expands to more than max_size bytes.
+bool DecompressPayload(std::string_view compressed, size_t max_size, std::string* out);
+
+}  // namespace impl
+}  // namespace discovery
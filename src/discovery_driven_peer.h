@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "discovery/discovery_ip_port.h"
+#include "discovery/discovery_peer.h"
+#include "discovery/discovery_peer_parameters.h"
+
+namespace discovery {
+namespace impl {
+
+// Carries the datagrams a peer sends. Peers started normally send through a
+// UDP socket to the broadcast and multicast addresses; SimulatedNetwork
+// substitutes an in-memory network.
+class Transport {
+ public:
+  virtual ~Transport() = default;
+
+  // Sends data to every destination. Returns the number of destinations it
+  // could not be sent to.
+  virtual size_t Send(const std::string& data) = 0;
+
+  // Returns the number of destinations every datagram is sent to.
+  virtual size_t destination_count() const = 0;
+};
+
+// A peer run by its owner rather than by threads of its own: the owner
+// supplies the time, runs sending rounds when they are due and hands over
+// received datagrams. None of the methods block, so any number of driven
+// peers can share one thread and a virtual clock.
+class DrivenPeer : public PeerEnvInterface {
+ public:
+  // Sends whatever announcement is due at cur_time_ms and expires idle
+  // peers. After Exit() it sends the departure packet instead and returns
+  // false; the peer is finished then.
+  virtual bool RunSendingRound(int64_t cur_time_ms) = 0;
+
+  // Returns the time the next sending round is due at, 0 if it is due now
+  // or PeerTable::kNoExpiry if nothing is scheduled.
+  virtual int64_t SendingWakeup() = 0;
+
+  // A received datagram, as handed to the batch overload of Receive().
+  struct Datagram {
+    IpPort from;
+    const char* data;
+    size_t size;
+  };
+
+  // Decodes and applies a datagram received from sender at cur_time_ms.
+  virtual void Receive(int64_t cur_time_ms, const IpPort& from, const char* data, size_t size) = 0;
+
+  // Decodes count datagrams received at cur_time_ms and applies them as one
+  // batch, under one lock and with one snapshot published, the way the
+  // receiving thread applies what it drained from the socket.
+  virtual void Receive(int64_t cur_time_ms, const Datagram* datagrams, size_t count) = 0;
+};
+
+// Returns true if a peer started with parameters counts the peers it hears
+// announcing without discovering them, to size its announce interval and
+// its query response window.
+inline bool CountsAnnouncers(const PeerParameters& parameters) {
+  return !parameters.can_discover() && parameters.can_be_discovered() &&
+         (parameters.max_announce_rate() > 0 || parameters.use_queries());
+}
+
+// Returns true if a peer started with parameters receives datagrams: it
+// discovers, or it counts announcers and answers queries.
+inline bool ReceivesDatagrams(const PeerParameters& parameters) {
+  return parameters.can_discover() || CountsAnnouncers(parameters);
+}
+
+// Starts a driven peer that sends through transport and derives its peer_id
+// and random delays from seed, so that runs are reproducible. Returns
+// nullptr if parameters are invalid.
+std::shared_ptr<DrivenPeer> StartDrivenPeer(const PeerParameters& parameters, const std::string& user_data,
+                                            std::unique_ptr<Transport> transport, uint32_t seed);
+
+}  // namespace impl
+}  // namespace discovery
@@ -0,0 +1,70 @@
+#include "discovery/discovery_error_sink.h"
+
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+
+#include "discovery/discovery_peer.h"
+
+namespace {
+
+// Rate limiting state of one distinct message.
+struct ReportState {
+  int64_t last_report_ms = 0;
+  uint64_t suppressed = 0;
+};
+
+std::mutex& SinkMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+discovery::ErrorSink& Sink() {
+  static discovery::ErrorSink sink;
+  return sink;
+}
+
+std::unordered_map<std::string, ReportState>& ReportStates() {
+  static std::unordered_map<std::string, ReportState> states;
+  return states;
+}
+
+}  // namespace
+
+namespace discovery {
+
+void SetErrorSink(ErrorSink sink) {
+  std::lock_guard<std::mutex> lock(SinkMutex());
+  Sink() = std::move(sink);
+}
+
+namespace impl {
+
+void ReportError(const std::string& message) {
+  int64_t cur_time_ms = NowTime();
+  ErrorSink sink;
+  std::string report = message;
+  {
+    std::lock_guard<std::mutex> lock(SinkMutex());
+    ReportState& state = ReportStates()[message];
+    if (state.last_report_ms != 0 && cur_time_ms - state.last_report_ms < kErrorReportIntervalMs) {
+      ++state.suppressed;
+      return;
+    }
+    if (state.suppressed != 0) {
+      report += " (" + std::to_string(state.suppressed) + " similar messages suppressed)";
+    }
+    state.last_report_ms = cur_time_ms;
+    state.suppressed = 0;
+    sink = Sink();
+  }
+
+  if (sink) {
+    sink(report);
+  } else {
+    std::cerr << report << std::endl;
+  }
+}
+
+}  // namespace impl
+}  // namespace discovery
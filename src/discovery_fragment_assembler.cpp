@@ -0,0 +1,169 @@
+#include "discovery_fragment_assembler.h"
+
+#include <cstring>
+#include <unordered_map>
+
+namespace discovery {
+namespace impl {
+
+FragmentAssembler::FragmentAssembler(size_t max_bytes, size_t max_sets_per_source, int64_t timeout_ms)
+    : max_bytes_(max_bytes), max_sets_per_source_(max_sets_per_source), timeout_ms_(timeout_ms) {}
+
+bool FragmentAssembler::Add(int64_t cur_time_ms, const IpPort& from, const PacketView& fragment,
+                            std::string* payload_out) {
+  dropTimedOut(cur_time_ms);
+  uint64_t sender_key = (static_cast<uint64_t>(from.ip()) << 16) | from.port();
+
+  Completed* completed = findCompleted(sender_key, fragment.peer_id());
+  if (completed != nullptr && fragment.snapshot_index() <= completed->snapshot_index) {
+    return false;
+  }
+
+  size_t index = 0;
+  while (index < assemblies_.size() &&
+         (assemblies_[index].sender_key != sender_key || assemblies_[index].peer_id != fragment.peer_id())) {
+    ++index;
+  }
+  if (index < assemblies_.size()) {
+    if (fragment.snapshot_index() < assemblies_[index].snapshot_index) {
+      return false;
+    }
+    if (fragment.snapshot_index() > assemblies_[index].snapshot_index) {
+      erase(index);
+      index = assemblies_.size();
+    }
+  }
+  if (index == assemblies_.size()) {
+    index = startAssembly(sender_key, from.ip(), fragment.peer_id(), fragment.fragmented_size());
+    if (index == assemblies_.size()) {
+      return false;
+    }
+    assemblies_[index].snapshot_index = fragment.snapshot_index();
+  }
+
+  Assembly& assembly = assemblies_[index];
+  assembly.last_fragment_ms = cur_time_ms;
+  uint32_t bit = 1u << fragment.fragment_index();
+  if ((assembly.received_mask & bit) != 0) {
+    return false;
+  }
+  // Fragments of one set must agree on the payload size.
+  if (assembly.payload.size() != fragment.fragmented_size()) {
+    return false;
+  }
+
+  std::string_view data = fragment.fragment_data();
+  std::memcpy(&assembly.payload[fragment.fragment_index() * kMaxFragmentDataSize], data.data(), data.size());
+  assembly.received_mask |= bit;
+  if (++assembly.received_count < fragment.fragment_count()) {
+    return false;
+  }
+
+  if (completed == nullptr) {
+    if (completed_.size() >= kMaxCompletedRecords) {
+      completed_.erase(completed_.begin());
+    }
+    completed_.emplace_back();
+    completed = &completed_.back();
+    completed->sender_key = sender_key;
+    completed->peer_id = fragment.peer_id();
+  }
+  completed->snapshot_index = assembly.snapshot_index;
+  completed->completed_ms = cur_time_ms;
+
+  payload_out->swap(assembly.payload);
+  pending_bytes_ -= payload_out->size();
+  assembly.payload.clear();
+  erase(index);
+  return true;
+}
+
+void FragmentAssembler::dropTimedOut(int64_t cur_time_ms) {
+  for (size_t i = 0; i < assemblies_.size();) {
+    if (cur_time_ms - assemblies_[i].last_fragment_ms > timeout_ms_) {
+      erase(i);
+    } else {
+      ++i;
+    }
+  }
+  // Records are appended in completion order.
+  size_t expired = 0;
+  while (expired < completed_.size() && cur_time_ms - completed_[expired].completed_ms > timeout_ms_) {
+    ++expired;
+  }
+  completed_.erase(completed_.begin(), completed_.begin() + static_cast<std::ptrdiff_t>(expired));
+}
+
+FragmentAssembler::Completed* FragmentAssembler::findCompleted(uint64_t sender_key, uint32_t peer_id) {
+  for (auto& completed : completed_) {
+    if (completed.sender_key == sender_key && completed.peer_id == peer_id) {
+      return &completed;
+    }
+  }
+  return nullptr;
+}
+
+size_t FragmentAssembler::startAssembly(uint64_t sender_key, uint32_t source_ip, uint32_t peer_id,
+                                        size_t payload_size) {
+  if (payload_size > max_bytes_ || max_sets_per_source_ == 0) {
+    return assemblies_.size();
+  }
+
+  size_t source_sets = 0;
+  for (const auto& assembly : assemblies_) {
+    if (assembly.source_ip == source_ip) {
+      ++source_sets;
+    }
+  }
+  if (source_sets >= max_sets_per_source_) {
+    evictOldestOf(source_ip);
+  }
+
+  while (pending_bytes_ + payload_size > max_bytes_) {
+    std::unordered_map<uint32_t, size_t> bytes_by_source;
+    uint32_t largest_source = 0;
+    size_t largest_bytes = 0;
+    for (const auto& assembly : assemblies_) {
+      size_t& bytes = bytes_by_source[assembly.source_ip];
+      bytes += assembly.payload.size();
+      if (bytes > largest_bytes) {
+        largest_bytes = bytes;
+        largest_source = assembly.source_ip;
+      }
+    }
+    evictOldestOf(largest_source);
+  }
+
+  assemblies_.emplace_back();
+  Assembly& assembly = assemblies_.back();
+  assembly.sender_key = sender_key;
+  assembly.source_ip = source_ip;
+  assembly.peer_id = peer_id;
+  assembly.payload.assign(payload_size, '\0');
+  pending_bytes_ += payload_size;
+  return assemblies_.size() - 1;
+}
+
+void FragmentAssembler::evictOldestOf(uint32_t source_ip) {
+  size_t oldest = assemblies_.size();
+  for (size_t i = 0; i < assemblies_.size(); ++i) {
+    if (assemblies_[i].source_ip == source_ip &&
+        (oldest == assemblies_.size() || assemblies_[i].last_fragment_ms < assemblies_[oldest].last_fragment_ms)) {
+      oldest = i;
+    }
+  }
+  if (oldest < assemblies_.size()) {
+    erase(oldest);
+  }
+}
+
+void FragmentAssembler::erase(size_t index) {
+  pending_bytes_ -= assemblies_[index].payload.size();
+  if (index + 1 != assemblies_.size()) {
+    assemblies_[index] = std::move(assemblies_.back());
+  }
+  assemblies_.pop_back();
+}
+
+}  // namespace impl
+}  // namespace discovery
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "discovery/discovery_ip_port.h"
+#include "discovery/discovery_protocol.h"
+
+namespace discovery {
+namespace impl {
+
+// Reassembles payloads sent as kIAmHereFragment packets.
+//
+// Fragment sets are keyed by sender and peer_id and identified by their
+// snapshot_index: a newer snapshot_index replaces an incomplete set, while
+// fragments of older or already completed sets are dropped.
+//
+// Memory is bounded per source and in total. A source IP address holds at
+// most max_sets_per_source incomplete sets, so one host cycling peer_ids
+// only evicts its own sets. The payload buffers of all incomplete sets stay
+// within max_bytes; a set that does not fit evicts sets of the source
+// holding the most memory, least recently active first. A completed set is
+// freed at once, keeping only its snapshot_index to drop late duplicates,
+// and a set that has not received a fragment for timeout_ms is discarded.
+//
+// Not thread-safe; meant to be owned by the receiving thread.
+class FragmentAssembler {
+ public:
+  static constexpr size_t kDefaultMaxBytes = 1024 * 1024;
+  static constexpr size_t kDefaultMaxSetsPerSource = 8;
+  static constexpr int64_t kDefaultTimeoutMs = 1000;
+
+  explicit FragmentAssembler(size_t max_bytes = kDefaultMaxBytes,
+                             size_t max_sets_per_source = kDefaultMaxSetsPerSource,
+                             int64_t timeout_ms = kDefaultTimeoutMs);
+
+  // Adds a fragment validated by PacketView::Parse(), received from from at
+  // cur_time_ms. Returns true if it completes its set, in which case the
+  // payload is moved into payload_out.
+  bool Add(int64_t cur_time_ms, const IpPort& from, const PacketView& fragment, std::string* payload_out);
+
+  // Number of incomplete sets, and the bytes their payload buffers take.
+  size_t size() const { return assemblies_.size(); }
+  size_t pending_bytes() const { return pending_bytes_; }
+
+ private:
+  // Number of completed sets remembered to drop their late duplicates.
+  static constexpr size_t kMaxCompletedRecords = 256;
+
+  struct Assembly {
+    uint64_t sender_key = 0;
+    uint32_t source_ip = 0;
+    uint32_t peer_id = 0;
+    uint64_t snapshot_index = 0;
+    int64_t last_fragment_ms = 0;
+    uint32_t received_mask = 0;
+    size_t received_count = 0;
+    std::string payload;
+  };
+
+  struct Completed {
+    uint64_t sender_key = 0;
+    uint32_t peer_id = 0;
+    uint64_t snapshot_index = 0;
+    int64_t completed_ms = 0;
+  };
+
+  static_assert(kMaxFragmentCount <= 32, "received_mask holds one bit per fragment");
+
+  void dropTimedOut(int64_t cur_time_ms);
+
+  // Returns the completed record of sender_key and peer_id, or nullptr.
+  Completed* findCompleted(uint64_t sender_key, uint32_t peer_id);
+
+  // Starts a set of payload_size bytes, evicting others to make room.
+  // Returns its index in assemblies_, or assemblies_.size() if it cannot
+  // fit at all.
+  size_t startAssembly(uint64_t sender_key, uint32_t source_ip, uint32_t peer_id, size_t payload_size);
+
+  // Evicts the least recently active set of source_ip.
+  void evictOldestOf(uint32_t source_ip);
+
+  void erase(size_t index);
+
+  size_t max_bytes_;
+  size_t max_sets_per_source_;
+  int64_t timeout_ms_;
+  size_t pending_bytes_ = 0;
+  // Incomplete sets only.
+  std::vector<Assembly> assemblies_;
+  std::vector<Completed> completed_;
+};
+
+}  // namespace impl
+}  // namespace discovery
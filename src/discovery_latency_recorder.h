@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "discovery/discovery_peer_stats.h"
+
+namespace discovery {
+namespace impl {
+
+// Lock-free counterpart of LatencyHistogram. Record() costs one relaxed
+// atomic increment, so it can stay enabled on hot paths; readers on other
+// threads see each bucket eventually but not a consistent cut.
+class LatencyRecorder {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  LatencyRecorder() = default;
+
+  LatencyRecorder(const LatencyRecorder&) = delete;             // Non-copyable.
+  LatencyRecorder& operator=(const LatencyRecorder&) = delete;  // Non-copyable.
+
+  // Records the time elapsed since start.
+  void RecordSince(Clock::time_point start) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    Record(elapsed > 0 ? static_cast<uint64_t>(elapsed) : 0);
+  }
+
+  void Record(uint64_t duration_us) {
+    size_t index = 0;
+    while (duration_us != 0 && index + 1 < LatencyHistogram::kBucketCount) {
+      duration_us >>= 1;
+      ++index;
+    }
+    buckets_[index].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void CopyTo(LatencyHistogram* histogram) const {
+    for (size_t i = 0; i < LatencyHistogram::kBucketCount; ++i) {
+      histogram->set_bucket(i, buckets_[i].load(std::memory_order_relaxed));
+    }
+  }
+
+ private:
+  std::atomic<uint64_t> buckets_[LatencyHistogram::kBucketCount] = {};
+};
+
+}  // namespace impl
+}  // namespace discovery
@@ -0,0 +1,67 @@
+#include "discovery_packet_decoder.h"
+
+namespace discovery {
+namespace impl {
+
+bool PacketDecoder::Decode(int64_t cur_time_ms, const IpPort& from, const char* data, size_t size,
+                           PacketView& packet, Scratch* scratch) {
+  packets_received_.fetch_add(1, std::memory_order_relaxed);
+  switch (prefilter_.Check(data, size)) {
+    case PrefilterVerdict::kAccept:
+      break;
+    case PrefilterVerdict::kTruncated:
+      rejected_truncated_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    case PrefilterVerdict::kBadMagic:
+      rejected_bad_magic_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    case PrefilterVerdict::kBadVersion:
+      rejected_bad_version_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    case PrefilterVerdict::kBadType:
+      rejected_bad_type_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    case PrefilterVerdict::kForeignApplication:
+      rejected_foreign_application_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+  }
+
+  if (!packet.Parse(data, size)) {
+    rejected_malformed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  if (packet.packet_type() == kPacketIAmHereFragment) {
+    if (!fragment_assembler_.Add(cur_time_ms, from, packet, &scratch->reassembled)) {
+      return false;
+    }
+    packet.SetReassembled(scratch->reassembled);
+  }
+
+  if (!packet.Decompress(&scratch->decompressed)) {
+    rejected_malformed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  packets_accepted_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+PeerStats PacketDecoder::Stats() const {
+  PeerStats stats;
+  stats.set_packets_received(packets_received_.load(std::memory_order_relaxed));
+  stats.set_packets_accepted(packets_accepted_.load(std::memory_order_relaxed));
+  stats.set_rejected_truncated(rejected_truncated_.load(std::memory_order_relaxed));
+  stats.set_rejected_bad_magic(rejected_bad_magic_.load(std::memory_order_relaxed));
+  stats.set_rejected_bad_version(rejected_bad_version_.load(std::memory_order_relaxed));
+  stats.set_rejected_bad_type(rejected_bad_type_.load(std::memory_order_relaxed));
+  stats.set_rejected_foreign_application(rejected_foreign_application_.load(std::memory_order_relaxed));
+  stats.set_rejected_malformed(rejected_malformed_.load(std::memory_order_relaxed));
+  stats.set_rejected_oversized(rejected_oversized_.load(std::memory_order_relaxed));
+  stats.set_receive_queue_overflows(queue_overflows_.load(std::memory_order_relaxed));
+  stats.set_receive_queue_depth_max(queue_depth_max_.load(std::memory_order_relaxed));
+  batch_time_.CopyTo(stats.mutable_receive_batch_time());
+  return stats;
+}
+
+}  // namespace impl
+}  // namespace discovery
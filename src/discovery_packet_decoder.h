@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "discovery/discovery_ip_port.h"
+#include "discovery/discovery_peer_stats.h"
+#include "discovery/discovery_protocol.h"
+#include "discovery_fragment_assembler.h"
+#include "discovery_latency_recorder.h"
+
+namespace discovery {
+namespace impl {
+
+// Turns received datagrams into complete packets.
+//
+// Datagrams are prefiltered and parsed in place; fragment sets are
+// reassembled and compressed payloads decompressed into caller-provided
+// scratch buffers. Every datagram is counted, rejected ones by reason.
+//
+// Decode() and the Count*() methods but CountQueueOverflow() must be called
+// from a single receiving thread; Stats() may be called from any thread.
+class PacketDecoder {
+ public:
+  // Buffers backing a decoded packet until it has been applied.
+  struct Scratch {
+    std::string reassembled;
+    std::string decompressed;
+  };
+
+  // Accepts packets of any application.
+  PacketDecoder() = default;
+
+  // Accepts only packets of application_id.
+  explicit PacketDecoder(uint32_t application_id) : prefilter_(application_id) {}
+
+  PacketDecoder(const PacketDecoder&) = delete;             // Non-copyable.
+  PacketDecoder& operator=(const PacketDecoder&) = delete;  // Non-copyable.
+
+  // Points packet at the datagram received from sender at cur_time_ms.
+  // Returns true once packet is complete: fragments are held until their set
+  // is complete, which turns packet into the reassembled announcement.
+  bool Decode(int64_t cur_time_ms, const IpPort& from, const char* data, size_t size, PacketView& packet,
+              Scratch* scratch);
+
+  // Counts a datagram that did not fit the receive buffer.
+  void CountOversized() {
+    packets_received_.fetch_add(1, std::memory_order_relaxed);
+    rejected_oversized_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Counts a packet addressed to an application nobody listens for.
+  void CountForeignApplication() { rejected_foreign_application_.fetch_add(1, std::memory_order_relaxed); }
+
+  // Counts datagrams dropped because the receive queue was full. May be
+  // called from the thread draining the socket.
+  void CountQueueOverflow(size_t count) { queue_overflows_.fetch_add(count, std::memory_order_relaxed); }
+
+  // Records the number of datagrams waiting in the receive queue.
+  void RecordQueueDepth(size_t depth) {
+    uint64_t max_depth = queue_depth_max_.load(std::memory_order_relaxed);
+    while (depth > max_depth && !queue_depth_max_.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed)) {
+    }
+  }
+
+  // Time taken to decode and apply each received batch.
+  LatencyRecorder& batch_time() { return batch_time_; }
+
+  // Returns the receive-side counters.
+  PeerStats Stats() const;
+
+ private:
+  PacketPrefilter prefilter_;
+  FragmentAssembler fragment_assembler_;
+
+  std::atomic<uint64_t> packets_received_{0};
+  std::atomic<uint64_t> packets_accepted_{0};
+  std::atomic<uint64_t> rejected_truncated_{0};
+  std::atomic<uint64_t> rejected_bad_magic_{0};
+  std::atomic<uint64_t> rejected_bad_version_{0};
+  std::atomic<uint64_t> rejected_bad_type_{0};
+  std::atomic<uint64_t> rejected_foreign_application_{0};
+  std::atomic<uint64_t> rejected_malformed_{0};
+  std::atomic<uint64_t> rejected_oversized_{0};
+  std::atomic<uint64_t> queue_overflows_{0};
+  std::atomic<uint64_t> queue_depth_max_{0};
+  LatencyRecorder batch_time_;
+};
+
+}  // namespace impl
+}  // namespace discovery
@@ -1,14 +1,27 @@
 #include "discovery/discovery_peer.h"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <iostream>
+#include <condition_variable>
+#include <functional>
 #include <limits>
 #include <mutex>
 #include <random>
 #include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "discovery/discovery_error_sink.h"
+#include "discovery/discovery_peer_group.h"
 #include "discovery/discovery_protocol.h"
+#include "discovery_change_log.h"
+#include "discovery_compression.h"
+#include "discovery_driven_peer.h"
+#include "discovery_packet_decoder.h"
+#include "discovery_peer_table.h"
+#include "discovery_receive_queue.h"
 
 // Platform socket API includes and type aliases.
 #if defined(_WIN32)
@@ -18,14 +31,31 @@
 using SocketType = SOCKET;
 using AddressLenType = int;
 constexpr SocketType kInvalidSocket = INVALID_SOCKET;
+using PollFd = WSAPOLLFD;
 #else
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+
+#include <cerrno>
 using SocketType = int;
 using AddressLenType = socklen_t;
 constexpr SocketType kInvalidSocket = -1;
+using PollFd = pollfd;
+#endif
+
+#if defined(__linux__)
+#include <linux/filter.h>
+#include <sys/eventfd.h>
+#endif
+
+// Linux can move several datagrams per system call with recvmmsg() and
+// sendmmsg().
+#if defined(__linux__)
+#define DISCOVERY_HAVE_RECVMMSG 1
+#define DISCOVERY_HAVE_SENDMMSG 1
 #endif
 
 namespace {
@@ -40,25 +70,106 @@ void InitSockets() {
 #endif
 }
 
-void SetSocketTimeout(SocketType sock, int param, int timeout_ms) {
+void CloseSocket(SocketType sock) {
 #if defined(_WIN32)
-  setsockopt(sock, SOL_SOCKET, param, reinterpret_cast<const char*>(&timeout_ms), sizeof(timeout_ms));
+  closesocket(sock);
 #else
-  timeval timeout;
-  timeout.tv_sec = timeout_ms / 1000;
-  timeout.tv_usec = 1000 * (timeout_ms % 1000);
-  setsockopt(sock, SOL_SOCKET, param, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+  close(sock);
 #endif
 }
 
-void CloseSocket(SocketType sock) {
+// Waits until one of fds is readable. Returns false on a non-recoverable
+// error; interrupted waits are reported as success with no revents set.
+bool PollReadable(PollFd* fds, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    fds[i].events = POLLIN;
+    fds[i].revents = 0;
+  }
 #if defined(_WIN32)
-  closesocket(sock);
+  return WSAPoll(fds, static_cast<ULONG>(count), -1) >= 0;
 #else
-  close(sock);
+  return poll(fds, static_cast<nfds_t>(count), -1) >= 0 || errno == EINTR;
 #endif
 }
 
+// A pollable handle that another thread can make readable to interrupt a
+// blocking poll: an eventfd on Linux, a pipe on other POSIX systems and a
+// loopback UDP socket on Windows, where only sockets can be polled.
+class Waker {
+ public:
+  Waker() = default;
+  ~Waker() { Close(); }
+
+  Waker(const Waker&) = delete;             // Non-copyable.
+  Waker& operator=(const Waker&) = delete;  // Non-copyable.
+
+  bool Open() {
+#if defined(__linux__)
+    read_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    write_fd_ = read_fd_;
+    return read_fd_ != kInvalidSocket;
+#elif defined(_WIN32)
+    read_fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (read_fd_ == kInvalidSocket) {
+      return false;
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int addr_length = sizeof(addr);
+    if (bind(read_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        getsockname(read_fd_, reinterpret_cast<sockaddr*>(&addr), &addr_length) < 0 ||
+        connect(read_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+      Close();
+      return false;
+    }
+    write_fd_ = read_fd_;
+    return true;
+#else
+    int fds[2];
+    if (pipe(fds) < 0) {
+      return false;
+    }
+    read_fd_ = fds[0];
+    write_fd_ = fds[1];
+    return true;
+#endif
+  }
+
+  void Close() {
+    if (write_fd_ != kInvalidSocket && write_fd_ != read_fd_) {
+      CloseSocket(write_fd_);
+    }
+    if (read_fd_ != kInvalidSocket) {
+      CloseSocket(read_fd_);
+    }
+    read_fd_ = kInvalidSocket;
+    write_fd_ = kInvalidSocket;
+  }
+
+  SocketType fd() const { return read_fd_; }
+
+  // Makes fd() readable. The state is sticky; the handle is never drained
+  // because it is only signalled once, on shutdown.
+  void Signal() {
+#if defined(__linux__)
+    uint64_t value = 1;
+    ssize_t written = write(write_fd_, &value, sizeof(value));
+#elif defined(_WIN32)
+    char value = 0;
+    int written = send(write_fd_, &value, 1, 0);
+#else
+    char value = 0;
+    ssize_t written = write(write_fd_, &value, 1);
+#endif
+    (void)written;
+  }
+
+ private:
+  SocketType read_fd_ = kInvalidSocket;
+  SocketType write_fd_ = kInvalidSocket;
+};
+
 bool IsRightTime(int64_t last_action_time, int64_t now_time, int64_t timeout, int64_t& time_to_wait_out) {
   if (last_action_time == 0) {
     time_to_wait_out = timeout;
@@ -83,6 +194,474 @@ uint32_t MakeRandomId() {
   return dis(gen);
 }
 
+discovery::IpPort ToIpPort(const sockaddr_in& addr) {
+  return discovery::IpPort(ntohl(addr.sin_addr.s_addr), ntohs(addr.sin_port));
+}
+
+// Size of a receive buffer: one byte more than the largest valid datagram,
+// so that longer ones are recognized as oversized even where the socket API
+// does not report truncation.
+constexpr size_t kReceiveSlotSize = discovery::kMaxDatagramSize + 1;
+
+// Number of datagrams the receive queue holds for the decoding stage.
+constexpr size_t kReceiveQueueCapacity = 256;
+
+// Largest number of queued datagrams decoded and applied as one batch.
+constexpr size_t kApplyBatchSize = 128;
+
+// Rate, in responses per second, at which the whole population answers a
+// query when max_announce_rate is not set.
+constexpr double kQueryResponseRate = 1000;
+
+// Cap of the backoff between user data requests for one peer, in multiples
+// of send_timeout.
+constexpr int64_t kMaxUserDataRequestBackoff = 16;
+
+#if defined(DISCOVERY_HAVE_RECVMMSG)
+
+// Number of datagrams drained from the socket per recvmmsg() call.
+constexpr unsigned int kReceiveBatchSize = 32;
+
+// Message headers for receiving into consecutive buffers of
+// kReceiveSlotSize bytes with recvmmsg().
+class ReceiveBatch {
+ public:
+  ReceiveBatch() = default;
+
+  ReceiveBatch(const ReceiveBatch&) = delete;             // Non-copyable.
+  ReceiveBatch& operator=(const ReceiveBatch&) = delete;  // Non-copyable.
+
+  // Receives the datagrams queued on sock, up to count but at most the
+  // batch size, into the buffers starting at buffers without blocking.
+  // Returns a negative value on error or if none are queued.
+  int Receive(SocketType sock, char* buffers, size_t count) {
+    auto batch_size = static_cast<unsigned int>(std::min<size_t>(count, kReceiveBatchSize));
+    for (unsigned int i = 0; i < batch_size; ++i) {
+      iovecs_[i].iov_base = buffers + i * kReceiveSlotSize;
+      iovecs_[i].iov_len = kReceiveSlotSize;
+      messages_[i] = mmsghdr{};
+      messages_[i].msg_hdr.msg_name = &addresses_[i];
+      messages_[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+      messages_[i].msg_hdr.msg_iov = &iovecs_[i];
+      messages_[i].msg_hdr.msg_iovlen = 1;
+    }
+    return recvmmsg(sock, messages_, batch_size, MSG_DONTWAIT, nullptr);
+  }
+
+  size_t size(int i) const { return messages_[i].msg_len; }
+  bool truncated(int i) const {
+    return (messages_[i].msg_hdr.msg_flags & MSG_TRUNC) != 0 || size(i) > discovery::kMaxDatagramSize;
+  }
+  discovery::IpPort from(int i) const { return ToIpPort(addresses_[i]); }
+
+ private:
+  iovec iovecs_[kReceiveBatchSize];
+  sockaddr_in addresses_[kReceiveBatchSize];
+  mmsghdr messages_[kReceiveBatchSize];
+};
+
+#endif  // DISCOVERY_HAVE_RECVMMSG
+
+// A discovered peer paired with its identity under some SamePeerMode.
+using KeyedPeer = std::pair<uint64_t, const discovery::DiscoveredPeer*>;
+
+// Returns references to peers ordered by identity, keeping only the first
+// entry for each identity.
+template <typename Container>
+std::vector<KeyedPeer> SortByIdentity(discovery::PeerParameters::SamePeerMode mode, const Container& peers) {
+  std::vector<KeyedPeer> sorted;
+  sorted.reserve(peers.size());
+  for (const auto& peer : peers) {
+    sorted.emplace_back(discovery::impl::PeerTable::KeyOf(mode, peer.ip_port()), &peer);
+  }
+
+  auto by_key = [](const KeyedPeer& lhv, const KeyedPeer& rhv) { return lhv.first < rhv.first; };
+  std::stable_sort(sorted.begin(), sorted.end(), by_key);
+  auto same_key = [](const KeyedPeer& lhv, const KeyedPeer& rhv) { return lhv.first == rhv.first; };
+  sorted.erase(std::unique(sorted.begin(), sorted.end(), same_key), sorted.end());
+  return sorted;
+}
+
+template <typename Container>
+bool SamePeers(discovery::PeerParameters::SamePeerMode mode, const Container& lhv, const Container& rhv) {
+  auto sorted_lhv = SortByIdentity(mode, lhv);
+  auto sorted_rhv = SortByIdentity(mode, rhv);
+  return std::equal(sorted_lhv.begin(), sorted_lhv.end(), sorted_rhv.begin(), sorted_rhv.end(),
+                    [](const KeyedPeer& l, const KeyedPeer& r) { return l.first == r.first; });
+}
+
+template <typename Container>
+discovery::PeerChanges DiffPeers(discovery::PeerParameters::SamePeerMode mode, const Container& before,
+                                 const Container& after) {
+  auto sorted_before = SortByIdentity(mode, before);
+  auto sorted_after = SortByIdentity(mode, after);
+
+  discovery::PeerChanges changes;
+  auto b = sorted_before.begin();
+  auto a = sorted_after.begin();
+  while (b != sorted_before.end() || a != sorted_after.end()) {
+    if (a == sorted_after.end() || (b != sorted_before.end() && b->first < a->first)) {
+      changes.mutable_removed()->push_back(b->second->ip_port());
+      ++b;
+    } else if (b == sorted_before.end() || a->first < b->first) {
+      changes.mutable_added()->push_back(*a->second);
+      ++a;
+    } else {
+      if (a->second->user_data() != b->second->user_data()) {
+        changes.mutable_updated()->push_back(*a->second);
+      }
+      ++a;
+      ++b;
+    }
+  }
+  return changes;
+}
+
+// An announcement destination and the message reported if sending fails.
+struct SendDestination {
+  sockaddr_in addr;
+  const char* error_message;
+};
+
+sockaddr_in MakeAddress(uint32_t ip, uint16_t port) {
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(ip);
+  return addr;
+}
+
+// Sends the same datagram to every destination, with a single sendmmsg()
+// call where available. Returns the number of destinations it could not
+// be sent to.
+size_t SendToAll(SocketType sock, const std::string& data, const std::vector<SendDestination>& destinations) {
+  size_t first_unsent = 0;
+
+#if defined(DISCOVERY_HAVE_SENDMMSG)
+  constexpr size_t kMaxDestinations = 2;
+  iovec iov{const_cast<char*>(data.data()), data.size()};
+  mmsghdr messages[kMaxDestinations] = {};
+  size_t count = std::min(destinations.size(), kMaxDestinations);
+  for (size_t i = 0; i < count; ++i) {
+    messages[i].msg_hdr.msg_name = const_cast<sockaddr_in*>(&destinations[i].addr);
+    messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    messages[i].msg_hdr.msg_iov = &iov;
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  // sendmmsg() stops at the first failing message; the remaining ones are
+  // retried below so a failing broadcast does not suppress the multicast copy.
+  int sent = count > 0 ? sendmmsg(sock, messages, static_cast<unsigned int>(count), 0) : 0;
+  if (sent > 0) {
+    first_unsent = static_cast<size_t>(sent);
+  }
+#endif
+
+  size_t failed = 0;
+  for (size_t i = first_unsent; i < destinations.size(); ++i) {
+    if (sendto(sock, data.data(), static_cast<int>(data.size()), 0,
+               reinterpret_cast<const sockaddr*>(&destinations[i].addr), sizeof(sockaddr_in)) < 0) {
+      discovery::impl::ReportError(destinations[i].error_message);
+      ++failed;
+    }
+  }
+  return failed;
+}
+
+// Opens the unbound socket announcements are sent from and fills
+// destinations with the addresses they are sent to. Returns kInvalidSocket
+// on failure.
+SocketType OpenSendSocket(const discovery::PeerParameters& parameters, std::vector<SendDestination>* destinations) {
+  SocketType sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock == kInvalidSocket) {
+    discovery::impl::ReportError("discovery::Peer can't create socket.");
+    return kInvalidSocket;
+  }
+
+  {
+    int value = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST, reinterpret_cast<const char*>(&value), sizeof(value)) < 0) {
+      discovery::impl::ReportError("discovery::Peer failed to enable broadcast on socket.");
+    }
+  }
+
+  destinations->clear();
+  if (parameters.can_use_broadcast()) {
+    destinations->push_back(SendDestination{MakeAddress(INADDR_BROADCAST, parameters.port()),
+                                            "discovery::Peer failed to send broadcast packet."});
+  }
+  if (parameters.can_use_multicast()) {
+    destinations->push_back(SendDestination{MakeAddress(parameters.multicast_group_address(), parameters.port()),
+                                            "discovery::Peer failed to send multicast packet."});
+  }
+  return sock;
+}
+
+// Sends announcements through an unbound UDP socket, which it owns.
+class SocketTransport : public discovery::impl::Transport {
+ public:
+  SocketTransport(SocketType sock, std::vector<SendDestination> destinations)
+      : sock_(sock), destinations_(std::move(destinations)) {}
+
+  ~SocketTransport() override { CloseSocket(sock_); }
+
+  SocketTransport(const SocketTransport&) = delete;             // Non-copyable.
+  SocketTransport& operator=(const SocketTransport&) = delete;  // Non-copyable.
+
+  size_t Send(const std::string& data) override { return SendToAll(sock_, data, destinations_); }
+
+  size_t destination_count() const override { return destinations_.size(); }
+
+ private:
+  SocketType sock_;
+  std::vector<SendDestination> destinations_;
+};
+
+// Opens the socket transport of a peer started with parameters. Returns
+// nullptr on failure.
+std::unique_ptr<discovery::impl::Transport> OpenSendTransport(const discovery::PeerParameters& parameters) {
+  std::vector<SendDestination> destinations;
+  SocketType sock = OpenSendSocket(parameters, &destinations);
+  if (sock == kInvalidSocket) {
+    return nullptr;
+  }
+  return std::make_unique<SocketTransport>(sock, std::move(destinations));
+}
+
+// Opens the socket announcements are received on: bound to the port of
+// parameters and, if multicast is used, joined to its group. Returns
+// kInvalidSocket on failure.
+SocketType OpenBindingSocket(const discovery::PeerParameters& parameters) {
+  SocketType sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock == kInvalidSocket) {
+    discovery::impl::ReportError("discovery::Peer can't create binding socket.");
+    return kInvalidSocket;
+  }
+
+  {
+    int reuse_addr = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse_addr), sizeof(reuse_addr)) <
+        0) {
+      discovery::impl::ReportError("discovery::Peer failed to set SO_REUSEADDR.");
+    }
+#ifdef SO_REUSEPORT
+    int reuse_port = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const char*>(&reuse_port), sizeof(reuse_port)) <
+        0) {
+      discovery::impl::ReportError("discovery::Peer failed to set SO_REUSEPORT.");
+    }
+#endif
+  }
+
+  if (parameters.can_use_multicast()) {
+    ip_mreq mreq{};
+    mreq.imr_multiaddr.s_addr = htonl(parameters.multicast_group_address());
+    mreq.imr_interface.s_addr = INADDR_ANY;
+    if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, reinterpret_cast<const char*>(&mreq), sizeof(mreq)) < 0) {
+      CloseSocket(sock);
+      discovery::impl::ReportError("discovery::Peer failed to join multicast group.");
+      return kInvalidSocket;
+    }
+  }
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(parameters.port());
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  if (bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(sockaddr_in)) < 0) {
+    CloseSocket(sock);
+    discovery::impl::ReportError("discovery::Peer can't bind socket.");
+    return kInvalidSocket;
+  }
+  return sock;
+}
+
+#if defined(__linux__)
+
+// Attaches a classic BPF program to sock so that the kernel drops datagrams
+// without a valid fixed header: too short, wrong magic or version, unknown
+// packet type or, unless any_application is set, an application_id other
+// than application_id. Such datagrams never wake the receiving thread and
+// are not counted in PeerStats. Returns false if the kernel refuses the
+// program.
+bool AttachPacketFilter(SocketType sock, bool any_application, uint32_t application_id) {
+  // Socket filters on UDP sockets see the datagram with its UDP header.
+  constexpr uint32_t kUdpHeaderSize = 8;
+  constexpr uint32_t kAccept = 0xffffffff;
+
+  std::vector<sock_filter> code;
+  // Indices of the jumps taken to the final drop instruction, on a false
+  // comparison or, for the packet type, on a true one.
+  std::vector<size_t> drop_if_false;
+  std::vector<size_t> drop_if_true;
+  auto load = [&code](uint16_t size, uint32_t offset) {
+    code.push_back(BPF_STMT(BPF_LD | size | BPF_ABS, kUdpHeaderSize + offset));
+  };
+  auto require = [&code, &drop_if_false](uint16_t comparison, uint32_t value) {
+    drop_if_false.push_back(code.size());
+    code.push_back(BPF_JUMP(BPF_JMP | comparison | BPF_K, value, 0, 0));
+  };
+
+  code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0));
+  require(BPF_JGE, kUdpHeaderSize + discovery::kPacketHeaderSize);
+  load(BPF_W, discovery::impl::kMagicOffset);
+  require(BPF_JEQ, discovery::impl::LoadBigEndian<uint32_t>(discovery::impl::kPacketMagic));
+  load(BPF_B, discovery::impl::kVersionOffset);
+  require(BPF_JEQ, discovery::impl::kProtocolVersion);
+  load(BPF_B, discovery::impl::kPacketTypeOffset);
+  // Packet types are numbered from 0 to kQuery.
+  drop_if_true.push_back(code.size());
+  code.push_back(BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, static_cast<uint8_t>(discovery::kPacketQuery), 0, 0));
+  if (!any_application) {
+    load(BPF_W, discovery::impl::kApplicationIdOffset);
+    require(BPF_JEQ, application_id);
+  }
+  code.push_back(BPF_STMT(BPF_RET | BPF_K, kAccept));
+  size_t drop = code.size();
+  code.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+
+  for (size_t i : drop_if_false) {
+    code[i].jf = static_cast<uint8_t>(drop - i - 1);
+  }
+  for (size_t i : drop_if_true) {
+    code[i].jt = static_cast<uint8_t>(drop - i - 1);
+  }
+
+  sock_fprog program{static_cast<unsigned short>(code.size()), code.data()};
+  return setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == 0;
+}
+
+#endif  // __linux__
+
+// Blocks until sock is readable. Returns false once waker has been
+// signalled.
+bool WaitForDatagrams(SocketType sock, const Waker& waker) {
+  PollFd fds[2] = {};
+  fds[0].fd = sock;
+  fds[1].fd = waker.fd();
+  while (true) {
+    if (!PollReadable(fds, 2)) {
+      discovery::impl::ReportError("discovery::Peer failed to wait for incoming packets.");
+      return false;
+    }
+    if (fds[1].revents != 0) {
+      return false;
+    }
+    if (fds[0].revents != 0) {
+      return true;
+    }
+  }
+}
+
+// Drains sock into queue until waker is signalled, then closes queue.
+// Datagrams that arrive while queue is full are read anyway, so the socket
+// buffer keeps room for later ones, and dropped; decoder counts them.
+void ReadDatagrams(SocketType sock, const Waker& waker, discovery::impl::ReceiveQueue& queue,
+                   discovery::impl::PacketDecoder& decoder) {
+#if defined(DISCOVERY_HAVE_RECVMMSG)
+  ReceiveBatch batch;
+  std::vector<char> overflow(kReceiveBatchSize * kReceiveSlotSize);
+
+  while (WaitForDatagrams(sock, waker)) {
+    size_t writable = queue.BeginWrite(kReceiveBatchSize);
+    int received = writable > 0 ? batch.Receive(sock, queue.write_buffer(0), writable)
+                                : batch.Receive(sock, overflow.data(), kReceiveBatchSize);
+    if (received <= 0) {
+      continue;
+    }
+    if (writable == 0) {
+      decoder.CountQueueOverflow(static_cast<size_t>(received));
+      continue;
+    }
+    for (int i = 0; i < received; ++i) {
+      queue.SetWritten(static_cast<size_t>(i), batch.size(i), batch.from(i), batch.truncated(i));
+    }
+    queue.EndWrite(static_cast<size_t>(received));
+  }
+#else
+  std::vector<char> overflow(kReceiveSlotSize);
+  // A wake-up without a datagram waiting must not block the reader.
+#if defined(_WIN32)
+  constexpr int kReceiveFlags = 0;
+#else
+  constexpr int kReceiveFlags = MSG_DONTWAIT;
+#endif
+
+  while (WaitForDatagrams(sock, waker)) {
+    bool full = queue.BeginWrite(1) == 0;
+    char* buffer = full ? overflow.data() : queue.write_buffer(0);
+    sockaddr_in from_addr{};
+    AddressLenType addr_length = sizeof(sockaddr_in);
+
+    auto length = recvfrom(sock, buffer, static_cast<int>(kReceiveSlotSize), kReceiveFlags,
+                           reinterpret_cast<sockaddr*>(&from_addr), &addr_length);
+    if (length <= 0) {
+      continue;
+    }
+    if (full) {
+      decoder.CountQueueOverflow(1);
+      continue;
+    }
+    auto size = static_cast<size_t>(length);
+    queue.SetWritten(0, size, ToIpPort(from_addr), size > discovery::kMaxDatagramSize);
+    queue.EndWrite(1);
+  }
+#endif
+
+  queue.Close();
+}
+
+// Receives datagrams on sock until waker is signalled. A reader thread only
+// drains the socket into a queue, so that a stall in applying packets does
+// not back up the socket buffer; the calling thread decodes the queued
+// datagrams in place and hands them over a batch at a time as
+// deliver(cur_time_ms, senders, packets, count), which returns false to stop
+// receiving. The packets stay valid until deliver returns. The time taken
+// per batch is recorded in decoder.batch_time().
+template <typename Deliver>
+void ReceiveLoop(SocketType sock, const Waker& waker, discovery::impl::PacketDecoder& decoder, Deliver deliver) {
+  using discovery::impl::PacketDecoder;
+
+  discovery::impl::ReceiveQueue queue(kReceiveQueueCapacity, kReceiveSlotSize);
+  std::thread reader([&]() { ReadDatagrams(sock, waker, queue, decoder); });
+
+  std::vector<discovery::PacketView> packets(kApplyBatchSize);
+  std::vector<discovery::IpPort> senders(kApplyBatchSize);
+  std::vector<PacketDecoder::Scratch> scratch(kApplyBatchSize);
+
+  while (size_t queued = queue.WaitForRead()) {
+    decoder.RecordQueueDepth(queued);
+    size_t count = std::min(queued, kApplyBatchSize);
+    auto started_at = discovery::impl::LatencyRecorder::Clock::now();
+    int64_t cur_time_ms = discovery::impl::NowTime();
+
+    size_t accepted = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (queue.truncated(i)) {
+        decoder.CountOversized();
+        continue;
+      }
+      senders[accepted] = queue.from(i);
+      if (decoder.Decode(cur_time_ms, senders[accepted], queue.data(i), queue.size(i), packets[accepted],
+                         &scratch[accepted])) {
+        ++accepted;
+      }
+    }
+
+    bool keep_receiving = deliver(cur_time_ms, senders.data(), packets.data(), accepted);
+    queue.EndRead(count);
+    if (!keep_receiving) {
+      break;
+    }
+    decoder.batch_time().RecordSince(started_at);
+  }
+
+  // The reader stops once waker is signalled, which Exit() does before any
+  // deliver returns false.
+  reader.join();
+}
+
 }  // namespace
 
 namespace discovery {
@@ -96,7 +675,7 @@ int64_t NowTime() {
 
 void SleepFor(std::chrono::milliseconds duration) { std::this_thread::sleep_for(duration); }
 
-class PeerEnv : public PeerEnvInterface, public std::enable_shared_from_this<PeerEnv> {
+class PeerEnv : public DrivenPeer, public std::enable_shared_from_this<PeerEnv> {
  public:
   PeerEnv() = default;
 
@@ -104,297 +683,1092 @@ class PeerEnv : public PeerEnvInterface, public std::enable_shared_from_this<Pee
     if (binding_sock_ != kInvalidSocket) {
       CloseSocket(binding_sock_);
     }
-    if (sock_ != kInvalidSocket) {
-      CloseSocket(sock_);
-    }
   }
 
   PeerEnv(const PeerEnv&) = delete;             // Non-copyable.
   PeerEnv& operator=(const PeerEnv&) = delete;  // Non-copyable.
 
+  // Prepares a peer that runs its own sending and receiving threads.
   bool Start(const PeerParameters& parameters, const std::string& user_data) {
+    if (!init(parameters, user_data, MakeRandomId())) {
+      return false;
+    }
+    InitSockets();
+    transport_ = OpenSendTransport(parameters_);
+    if (!transport_) {
+      return false;
+    }
+    decoder_ = std::make_shared<PacketDecoder>(parameters_.application_id());
+
+    // A peer that cannot discover still listens to count announcers and
+    // answer queries.
+    if (ReceivesDatagrams(parameters_)) {
+      binding_sock_ = OpenBindingSocket(parameters_);
+      if (binding_sock_ == kInvalidSocket) {
+        transport_.reset();
+        return false;
+      }
+#if defined(__linux__)
+      if (parameters_.use_socket_filter() &&
+          !AttachPacketFilter(binding_sock_, false, parameters_.application_id())) {
+        ReportError("discovery::Peer failed to attach socket filter.");
+      }
+#endif
+
+      if (!waker_.Open()) {
+        CloseSocket(binding_sock_);
+        binding_sock_ = kInvalidSocket;
+
+        transport_.reset();
+
+        ReportError("discovery::Peer can't create wakeup handle.");
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Prepares a peer hosted by a PeerGroup, which receives for it through
+  // decoder and runs its sending rounds; wake_scheduler is called whenever
+  // a round becomes due early.
+  bool StartInGroup(const PeerParameters& parameters, const std::string& user_data,
+                    std::shared_ptr<PacketDecoder> decoder, std::function<void()> wake_scheduler) {
+    if (!init(parameters, user_data, MakeRandomId())) {
+      return false;
+    }
+    InitSockets();
+    transport_ = OpenSendTransport(parameters_);
+    if (!transport_) {
+      return false;
+    }
+    decoder_ = std::move(decoder);
+    wake_scheduler_ = std::move(wake_scheduler);
+    return true;
+  }
+
+  // Prepares a peer driven by its owner; see StartDrivenPeer().
+  bool StartDriven(const PeerParameters& parameters, const std::string& user_data,
+                   std::unique_ptr<Transport> transport, uint32_t seed) {
+    if (!init(parameters, user_data, seed)) {
+      return false;
+    }
+    transport_ = std::move(transport);
+    decoder_ = std::make_shared<PacketDecoder>(parameters_.application_id());
+    return true;
+  }
+
+  const PeerParameters& parameters() const { return parameters_; }
+
+  void SetUserData(const std::string& user_data) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (user_data_ != user_data) {
+      user_data_ = user_data;
+      frame_dirty_ = true;
+      full_announcement_pending_ = true;
+      resend_requested_ = true;
+      wakeSender();
+    }
+  }
+
+  std::list<DiscoveredPeer> ListDiscovered() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return discovered_peers_.ToList();
+  }
+
+  DiscoveredPeersSnapshot Snapshot() override { return std::atomic_load(&snapshot_); }
+
+  PeerStats GetStats() override {
+    PeerStats stats = decoder_->Stats();
+    stats.set_rejected_self(rejected_self_.load(std::memory_order_relaxed));
+    stats.set_packets_sent(packets_sent_.load(std::memory_order_relaxed));
+    stats.set_send_failures(send_failures_.load(std::memory_order_relaxed));
+    stats.set_peers_joined(peers_joined_.load(std::memory_order_relaxed));
+    stats.set_peers_updated(peers_updated_.load(std::memory_order_relaxed));
+    stats.set_peers_left(peers_left_.load(std::memory_order_relaxed));
+    stats.set_peers_expired(peers_expired_.load(std::memory_order_relaxed));
+    stats.set_table_size(table_size_.load(std::memory_order_relaxed));
+    lock_hold_time_.CopyTo(stats.mutable_lock_hold_time());
+    return stats;
+  }
+
+  PeerChanges ChangesSince(uint64_t generation) override {
+    PeerChanges changes;
+    std::lock_guard<std::mutex> lock(mutex_);
+    change_log_.Collect(generation, discovered_peers_, changes);
+    return changes;
+  }
+
+  std::shared_ptr<PeerSubscription> Subscribe(size_t max_queued_events) override {
+    if (!parameters_.can_discover()) {
+      return nullptr;
+    }
+
+    auto subscription = std::make_shared<PeerSubscription>(max_queued_events);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (exit_) {
+      subscription->Close();
+      return subscription;
+    }
+    for (const auto& peer : discovered_peers_.peers()) {
+      subscription->Push(PeerEventType::kJoined, peer);
+    }
+    subscriptions_.push_back(subscription);
+    return subscription;
+  }
+
+  void Exit() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exit_ = true;
+    for (const auto& subscription : subscriptions_) {
+      subscription->Close();
+    }
+    subscriptions_.clear();
+    wakeSender();
+    if (waker_.fd() != kInvalidSocket) {
+      waker_.Signal();
+    }
+  }
+
+  void WaitForExit() override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_cv_.wait(lock, [this]() { return finished_; });
+  }
+
+  void SendingThreadFunc() {
+    while (RunSendingRound(NowTime())) {
+      waitForSendingWork();
+    }
+  }
+
+  void ReceivingThreadFunc() {
+    ReceiveLoop(binding_sock_, waker_, *decoder_,
+                [this](int64_t cur_time_ms, const IpPort* senders, const PacketView* packets, size_t count) {
+                  return Deliver(cur_time_ms, senders, packets, count);
+                });
+  }
+
+  bool RunSendingRound(int64_t cur_time_ms) override {
+    bool should_exit = false;
+    bool should_resend = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      should_exit = exit_;
+      should_resend = resend_requested_;
+      resend_requested_ = false;
+      sender_woken_ = false;
+      sender_wakeup_ms_ = 0;
+      if (query_response_due_ms_ != 0 && query_response_due_ms_ <= cur_time_ms) {
+        query_response_due_ms_ = 0;
+        // A full announcement sent since the query has answered it already.
+        if (full_announcements_sent_ == full_announcements_at_query_) {
+          should_resend = true;
+          full_announcement_pending_ = true;
+        }
+      }
+    }
+
+    if (should_exit) {
+      sendPacket(kPacketIAmOutOfHere, cur_time_ms);
+      std::lock_guard<std::mutex> lock(mutex_);
+      finished_ = true;
+      finished_cv_.notify_all();
+      return false;
+    }
+
+    if (query_pending_) {
+      query_pending_ = false;
+      sendControlPacket(kPacketQuery, std::string());
+    }
+
+    int64_t send_wait_ms = std::numeric_limits<int64_t>::max();
+
+    if (parameters_.can_be_discovered()) {
+      // Resends are held back until min_resend_interval has passed since
+      // the previous announcement.
+      bool resend = should_resend || resend_deferred_;
+      int64_t resend_wait = 0;
+      if (resend && last_send_time_ms_ != 0) {
+        resend_wait = last_send_time_ms_ + parameters_.min_resend_interval_ms() - cur_time_ms;
+      }
+      resend_deferred_ = resend && resend_wait > 0;
+
+      int64_t next_send_wait = 0;
+      bool periodic = IsRightTime(last_send_time_ms_, cur_time_ms, send_interval_ms_, next_send_wait);
+      if (periodic || (resend && !resend_deferred_)) {
+        sendPacket(kPacketIAmHere, cur_time_ms);
+        int64_t interval_ms = nextSendInterval();
+        next_send_wait = resend ? interval_ms : next_send_wait + (interval_ms - send_interval_ms_);
+        send_interval_ms_ = interval_ms;
+        last_send_time_ms_ = cur_time_ms;
+        resend_deferred_ = false;
+      }
+      send_wait_ms = resend_deferred_ ? std::min(next_send_wait, resend_wait) : next_send_wait;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (parameters_.can_discover()) {
+      auto locked_at = LatencyRecorder::Clock::now();
+      updateTtl(cur_time_ms);
+      deleteIdle(cur_time_ms);
+      lock_hold_time_.RecordSince(locked_at);
+    } else if (!announcers_.empty()) {
+      deleteIdleAnnouncers(cur_time_ms);
+    }
+
+    int64_t wakeup_ms = PeerTable::kNoExpiry;
+    if (send_wait_ms != std::numeric_limits<int64_t>::max()) {
+      wakeup_ms = cur_time_ms + send_wait_ms;
+    }
+    if (query_response_due_ms_ != 0) {
+      wakeup_ms = std::min(wakeup_ms, query_response_due_ms_);
+    }
+    sender_wakeup_ms_ = std::min(wakeup_ms, discovered_peers_.NextExpiry());
+    return true;
+  }
+
+  int64_t SendingWakeup() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return exit_ || sender_woken_ ? 0 : sender_wakeup_ms_;
+  }
+
+  // Applies count packets received at cur_time_ms. Returns false once the
+  // peer has exited.
+  bool Deliver(int64_t cur_time_ms, const IpPort* senders, const PacketView* packets, size_t count) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto locked_at = LatencyRecorder::Clock::now();
+      if (exit_) {
+        return false;
+      }
+      for (size_t i = 0; i < count; ++i) {
+        if (acceptsPacket(packets[i])) {
+          applyReceived(cur_time_ms, senders[i], packets[i], &requests_);
+        }
+      }
+      publishSnapshot();
+      rescheduleSender();
+      lock_hold_time_.RecordSince(locked_at);
+    }
+    sendUserDataRequests(&requests_);
+    return true;
+  }
+
+  void Receive(int64_t cur_time_ms, const IpPort& from, const char* data, size_t size) override {
+    Datagram datagram{from, data, size};
+    Receive(cur_time_ms, &datagram, 1);
+  }
+
+  void Receive(int64_t cur_time_ms, const Datagram* datagrams, size_t count) override {
+    if (receive_scratch_.size() < count) {
+      receive_packets_.resize(count);
+      receive_senders_.resize(count);
+      receive_scratch_.resize(count);
+    }
+    size_t accepted = 0;
+    for (size_t i = 0; i < count; ++i) {
+      receive_senders_[accepted] = datagrams[i].from;
+      if (decoder_->Decode(cur_time_ms, datagrams[i].from, datagrams[i].data, datagrams[i].size,
+                           receive_packets_[accepted], &receive_scratch_[accepted])) {
+        ++accepted;
+      }
+    }
+    if (accepted > 0) {
+      Deliver(cur_time_ms, receive_senders_.data(), receive_packets_.data(), accepted);
+    }
+  }
+
+ private:
+  // Validates parameters and seeds the peer_id and the random generators
+  // from seed. Returns false if parameters are invalid.
+  bool init(const PeerParameters& parameters, const std::string& user_data, uint32_t seed) {
     parameters_ = parameters;
     user_data_ = user_data;
+    discovered_peers_ = PeerTable(parameters_.same_peer_mode(), parameters_.discovered_peer_ttl_ms());
 
     if (!parameters_.can_use_broadcast() && !parameters_.can_use_multicast()) {
-      std::cerr << "discovery::Peer can't use broadcast and can't use multicast." << std::endl;
+      ReportError("discovery::Peer can't use broadcast and can't use multicast.");
       return false;
     }
 
     if (!parameters_.can_discover() && !parameters_.can_be_discovered()) {
-      std::cerr << "discovery::Peer can't discover and can't be discovered." << std::endl;
+      ReportError("discovery::Peer can't discover and can't be discovered.");
       return false;
     }
 
-    InitSockets();
-
-    peer_id_ = MakeRandomId();
+    std::mt19937 seed_gen(seed);
+    peer_id_ = std::uniform_int_distribution<uint32_t>()(seed_gen);
+    jitter_gen_.seed(seed_gen());
+    response_gen_.seed(seed_gen());
+    // Generations of a previous run fall outside the new epoch.
+    constexpr uint32_t kMaxEpoch = (1u << (64 - ChangeLog::kEpochShift)) - 1;
+    change_log_.Restart(std::uniform_int_distribution<uint32_t>(1, kMaxEpoch)(seed_gen));
+    send_interval_ms_ = parameters_.send_timeout_ms();
+    burst_remaining_ = parameters_.startup_burst_count();
+    burst_interval_ms_ = parameters_.startup_burst_interval_ms();
+    query_pending_ = parameters_.can_discover() && parameters_.use_queries();
+    return true;
+  }
 
-    sock_ = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock_ == kInvalidSocket) {
-      std::cerr << "discovery::Peer can't create socket." << std::endl;
+  // Returns true if a decoded packet concerns this peer. A peer that does
+  // not discover only takes queries and requests, which a PeerGroup
+  // delivers to it, and announcements if it counts announcers.
+  bool acceptsPacket(const PacketView& packet) {
+    if (packet.application_id() != parameters_.application_id()) {
       return false;
     }
+    if (!parameters_.can_discover() && packet.packet_type() != kPacketQuery &&
+        packet.packet_type() != kPacketUserDataRequest && !CountsAnnouncers(parameters_)) {
+      return false;
+    }
+    if (!parameters_.discover_self() && packet.peer_id() == peer_id_) {
+      rejected_self_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  // Folds an accepted packet into the discovered table. The peer_ids of
+  // heartbeat senders whose user data is unknown or outdated are appended to
+  // requests. Requires mutex_.
+  void applyReceived(int64_t cur_time_ms, const IpPort& from, const PacketView& packet,
+                     std::vector<uint32_t>* requests) {
+    if (!parameters_.can_discover() && packet.packet_type() != kPacketQuery &&
+        packet.packet_type() != kPacketUserDataRequest) {
+      countAnnouncer(cur_time_ms, packet);
+      return;
+    }
+    DiscoveredPeer* peer = discovered_peers_.Find(from);
+
+    if (packet.packet_type() == kPacketIAmHere) {
+      if ((packet.flags() & kPacketFlagExtensionsAware) == 0) {
+        legacy_peer_heard_ = true;
+        legacy_peer_heard_ms_ = cur_time_ms;
+      }
+      // Whatever its payload, the sender answered any pending request.
+      user_data_requests_.erase(packet.peer_id());
+      if (peer == nullptr) {
+        peer = &discovered_peers_.Insert(from, cur_time_ms);
+        peer->SetUserData(packet.user_data(), packet.snapshot_index());
+        peer->set_user_data_digest(UserDataDigest(packet.user_data()));
+        notifyPeerChanged(PeerEventType::kJoined, *peer);
+      } else if (peer->last_received_packet() < packet.snapshot_index()) {
+        // Announcements repeat the same payload; only a real change is copied.
+        if (peer->user_data() != packet.user_data()) {
+          peer->SetUserData(packet.user_data(), packet.snapshot_index());
+          peer->set_user_data_digest(UserDataDigest(packet.user_data()));
+          notifyPeerChanged(PeerEventType::kUserDataChanged, *peer);
+        } else {
+          peer->set_last_received_packet(packet.snapshot_index());
+        }
+      }
+      peer->set_last_updated(cur_time_ms);
+    } else if (packet.packet_type() == kPacketHeartbeat) {
+      // A heartbeat keeps a known peer alive, but user data can only be
+      // taken from a full announcement. It leaves last_received_packet
+      // alone, so that a full announcement overtaken by a later heartbeat
+      // is still taken.
+      if (peer == nullptr || peer->user_data_digest() != packet.user_data_digest()) {
+        if (std::find(requests->begin(), requests->end(), packet.peer_id()) == requests->end() &&
+            userDataRequestDue(cur_time_ms, packet.peer_id())) {
+          requests->push_back(packet.peer_id());
+        }
+      }
+      if (peer != nullptr) {
+        peer->set_last_updated(cur_time_ms);
+      }
+    } else if (packet.packet_type() == kPacketUserDataRequest) {
+      if (packet.requested_peer_id() == peer_id_ && parameters_.can_be_discovered()) {
+        full_announcement_pending_ = true;
+        resend_requested_ = true;
+        wakeSender();
+      } else if (parameters_.can_discover()) {
+        // Another peer asked already; its answer reaches this peer as well.
+        UserDataRequestState& state = user_data_requests_[packet.requested_peer_id()];
+        state.next_request_ms = std::max(state.next_request_ms, cur_time_ms + parameters_.send_timeout_ms());
+        state.touched_ms = cur_time_ms;
+      }
+    } else if (packet.packet_type() == kPacketQuery) {
+      // Queries arriving while a response is scheduled share that response.
+      if (parameters_.can_be_discovered() && parameters_.use_queries() && query_response_due_ms_ == 0) {
+        full_announcements_at_query_ = full_announcements_sent_;
+        query_response_due_ms_ = cur_time_ms + queryResponseDelay();
+        if (query_response_due_ms_ < sender_wakeup_ms_) {
+          wakeSender();
+        }
+      }
+    } else if (packet.packet_type() == kPacketIAmOutOfHere) {
+      if (peer != nullptr) {
+        notifyPeerChanged(PeerEventType::kLeft, *peer);
+        discovered_peers_.Erase(from);
+      }
+    }
+  }
+
+  // Records a membership or user data change: marks the published snapshot
+  // stale, appends the change to the change log and delivers an event to
+  // every live subscription, forgetting the ones closed by their consumers.
+  // Requires mutex_.
+  void notifyPeerChanged(PeerEventType type, const DiscoveredPeer& peer) {
+    countPeerChange(type);
+    snapshot_dirty_ = true;
+    change_log_.Record(type, peer.ip_port());
+    if (subscriptions_.empty()) {
+      return;
+    }
+
+    auto closed = std::remove_if(subscriptions_.begin(), subscriptions_.end(),
+                                 [](const std::shared_ptr<PeerSubscription>& s) { return s->closed(); });
+    subscriptions_.erase(closed, subscriptions_.end());
+    for (const auto& subscription : subscriptions_) {
+      subscription->Push(type, peer);
+    }
+  }
+
+  // Tracks the announcements of other peers heard by a peer that counts
+  // announcers instead of discovering them. Requires mutex_.
+  void countAnnouncer(int64_t cur_time_ms, const PacketView& packet) {
+    if (packet.packet_type() == kPacketIAmOutOfHere) {
+      announcers_.erase(packet.peer_id());
+    } else {
+      announcers_[packet.peer_id()] = cur_time_ms;
+    }
+  }
+
+  // Forgets the announcers not heard within the TTL, stretched along with
+  // the adaptive announce interval. Requires mutex_.
+  void deleteIdleAnnouncers(int64_t cur_time_ms) {
+    int64_t send_timeout_ms = std::max<int64_t>(parameters_.send_timeout_ms(), 1);
+    int64_t ttl_ms = parameters_.discovered_peer_ttl_ms() * adaptiveInterval() / send_timeout_ms;
+    for (auto it = announcers_.begin(); it != announcers_.end();) {
+      if (cur_time_ms - it->second > ttl_ms) {
+        it = announcers_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Returns the number of peers known to take part, this one included: the
+  // discovered ones or, for a peer that does not discover, the counted
+  // announcers. Requires mutex_.
+  size_t population() const {
+    return (parameters_.can_discover() ? discovered_peers_.size() : announcers_.size()) + 1;
+  }
+
+  // Returns the announce interval for the current population: send_timeout,
+  // or longer if max_announce_rate would be exceeded otherwise. Requires
+  // mutex_.
+  int64_t adaptiveInterval() const {
+    int64_t interval_ms = parameters_.send_timeout_ms();
+    if (parameters_.max_announce_rate() > 0) {
+      auto rate_limited_ms =
+          static_cast<int64_t>(static_cast<double>(population()) * 1000.0 / parameters_.max_announce_rate());
+      interval_ms = std::max(interval_ms, rate_limited_ms);
+    }
+    return interval_ms;
+  }
+
+  // Draws the interval until the next periodic announcement. During the
+  // startup burst the interval starts at startup_burst_interval and doubles
+  // with every announcement until it reaches the steady interval.
+  int64_t nextSendInterval() {
+    int64_t interval_ms = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      interval_ms = adaptiveInterval();
+    }
+    double jitter = parameters_.send_jitter();
+    if (jitter > 0) {
+      std::uniform_real_distribution<double> factor(1.0 - jitter, 1.0 + jitter);
+      interval_ms = static_cast<int64_t>(static_cast<double>(interval_ms) * factor(jitter_gen_));
+    }
+    if (burst_remaining_ > 0) {
+      --burst_remaining_;
+      interval_ms = std::min(interval_ms, burst_interval_ms_);
+      burst_interval_ms_ *= 2;
+    }
+    return interval_ms;
+  }
+
+  // Stretches the TTL of discovered peers along with the adaptive announce
+  // interval. A shorter TTL only takes effect once the current one has
+  // passed, since other peers may still be waiting out intervals chosen
+  // before the population shrank. Requires mutex_.
+  void updateTtl(int64_t cur_time_ms) {
+    if (parameters_.max_announce_rate() <= 0) {
+      return;
+    }
+    int64_t send_timeout_ms = std::max<int64_t>(parameters_.send_timeout_ms(), 1);
+    int64_t ttl_ms = parameters_.discovered_peer_ttl_ms() * adaptiveInterval() / send_timeout_ms;
+    if (ttl_ms >= discovered_peers_.ttl_ms()) {
+      ttl_shrink_due_ms_ = 0;
+      if (ttl_ms > discovered_peers_.ttl_ms()) {
+        discovered_peers_.set_ttl_ms(ttl_ms);
+      }
+      return;
+    }
+    if (ttl_shrink_due_ms_ == 0) {
+      ttl_shrink_due_ms_ = cur_time_ms + discovered_peers_.ttl_ms();
+    } else if (cur_time_ms >= ttl_shrink_due_ms_) {
+      ttl_shrink_due_ms_ = 0;
+      discovered_peers_.set_ttl_ms(ttl_ms);
+    }
+  }
+
+  void countPeerChange(PeerEventType type) {
+    switch (type) {
+      case PeerEventType::kJoined:
+        peers_joined_.fetch_add(1, std::memory_order_relaxed);
+        break;
+      case PeerEventType::kUserDataChanged:
+        peers_updated_.fetch_add(1, std::memory_order_relaxed);
+        break;
+      case PeerEventType::kLeft:
+        peers_left_.fetch_add(1, std::memory_order_relaxed);
+        break;
+      case PeerEventType::kExpired:
+        peers_expired_.fetch_add(1, std::memory_order_relaxed);
+        break;
+      case PeerEventType::kOverflow:
+        break;
+    }
+  }
+
+  // Requires mutex_.
+  void deleteIdle(int64_t cur_time_ms) {
+    discovered_peers_.EraseExpired(
+        cur_time_ms, [this](const DiscoveredPeer& peer) { notifyPeerChanged(PeerEventType::kExpired, peer); });
+    deleteIdleRequests(cur_time_ms);
+    publishSnapshot();
+  }
+
+  // Replaces the published snapshot if the table changed since it was last
+  // built. Requires mutex_.
+  void publishSnapshot() {
+    if (!snapshot_dirty_) {
+      return;
+    }
+    snapshot_dirty_ = false;
+    table_size_.store(discovered_peers_.size(), std::memory_order_relaxed);
+    auto peers = std::make_shared<const std::vector<DiscoveredPeer>>(discovered_peers_.peers());
+    std::atomic_store(&snapshot_, DiscoveredPeersSnapshot(std::move(peers)));
+  }
 
-    {
-      int value = 1;
-      if (setsockopt(sock_, SOL_SOCKET, SO_BROADCAST, reinterpret_cast<const char*>(&value), sizeof(value)) < 0) {
-        std::cerr << "discovery::Peer failed to enable broadcast on socket." << std::endl;
+  // Sleeps until the next sending round is due or another thread calls
+  // wakeSender(). Without pending work the thread sleeps indefinitely.
+  void waitForSendingWork() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto woken = [this]() { return exit_ || sender_woken_; };
+    if (sender_wakeup_ms_ == PeerTable::kNoExpiry) {
+      wake_cv_.wait(lock, woken);
+    } else {
+      int64_t delay_ms = sender_wakeup_ms_ - NowTime();
+      if (delay_ms > 0) {
+        wake_cv_.wait_for(lock, std::chrono::milliseconds(delay_ms), woken);
       }
     }
+  }
 
-    if (parameters_.can_discover()) {
-      binding_sock_ = socket(AF_INET, SOCK_DGRAM, 0);
-      if (binding_sock_ == kInvalidSocket) {
-        std::cerr << "discovery::Peer can't create binding socket." << std::endl;
+  // Makes the next sending round due at once. Requires mutex_.
+  void wakeSender() {
+    sender_woken_ = true;
+    wake_cv_.notify_one();
+    if (wake_scheduler_) {
+      wake_scheduler_();
+    }
+  }
 
-        CloseSocket(sock_);
-        sock_ = kInvalidSocket;
-        return false;
-      }
+  // Wakes the sending thread if a newly discovered peer expires before the
+  // time it is sleeping until. Requires mutex_.
+  void rescheduleSender() {
+    if (discovered_peers_.NextExpiry() < sender_wakeup_ms_) {
+      wakeSender();
+    }
+  }
 
-      {
-        int reuse_addr = 1;
-        if (setsockopt(binding_sock_, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse_addr),
-                       sizeof(reuse_addr)) < 0) {
-          std::cerr << "discovery::Peer failed to set SO_REUSEADDR." << std::endl;
-        }
-#ifdef SO_REUSEPORT
-        int reuse_port = 1;
-        if (setsockopt(binding_sock_, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const char*>(&reuse_port),
-                       sizeof(reuse_port)) < 0) {
-          std::cerr << "discovery::Peer failed to set SO_REUSEPORT." << std::endl;
-        }
-#endif
-      }
+  // Returns true if this peer should ask peer_id for its user data now, and
+  // if so backs off further requests for it: the first request goes out at
+  // once, later ones after send_timeout, doubling up to
+  // kMaxUserDataRequestBackoff times that, each drawn from the upper half of
+  // the backoff so that peers asking for the same data drift apart and
+  // overhear each other. Requires mutex_.
+  bool userDataRequestDue(int64_t cur_time_ms, uint32_t peer_id) {
+    UserDataRequestState& state = user_data_requests_[peer_id];
+    state.touched_ms = cur_time_ms;
+    if (cur_time_ms < state.next_request_ms) {
+      return false;
+    }
+    int64_t max_backoff_ms = kMaxUserDataRequestBackoff * parameters_.send_timeout_ms();
+    state.backoff_ms = state.backoff_ms == 0 ? parameters_.send_timeout_ms()
+                                             : std::min(2 * state.backoff_ms, max_backoff_ms);
+    state.next_request_ms =
+        cur_time_ms + std::uniform_int_distribution<int64_t>(state.backoff_ms / 2, state.backoff_ms)(response_gen_);
+    return true;
+  }
 
-      if (parameters_.can_use_multicast()) {
-        ip_mreq mreq{};
-        mreq.imr_multiaddr.s_addr = htonl(parameters_.multicast_group_address());
-        mreq.imr_interface.s_addr = INADDR_ANY;
-        if (setsockopt(binding_sock_, IPPROTO_IP, IP_ADD_MEMBERSHIP, reinterpret_cast<const char*>(&mreq),
-                       sizeof(mreq)) < 0) {
-          CloseSocket(binding_sock_);
-          binding_sock_ = kInvalidSocket;
-          CloseSocket(sock_);
-          sock_ = kInvalidSocket;
-          std::cerr << "discovery::Peer failed to join multicast group." << std::endl;
-          return false;
-        }
+  // Forgets the request state of peers not heard of within the TTL.
+  // Requires mutex_.
+  void deleteIdleRequests(int64_t cur_time_ms) {
+    for (auto it = user_data_requests_.begin(); it != user_data_requests_.end();) {
+      if (cur_time_ms - it->second.touched_ms > parameters_.discovered_peer_ttl_ms()) {
+        it = user_data_requests_.erase(it);
+      } else {
+        ++it;
       }
+    }
+  }
 
-      sockaddr_in addr{};
-      addr.sin_family = AF_INET;
-      addr.sin_port = htons(parameters_.port());
-      addr.sin_addr.s_addr = htonl(INADDR_ANY);
-
-      if (bind(binding_sock_, reinterpret_cast<sockaddr*>(&addr), sizeof(sockaddr_in)) < 0) {
-        CloseSocket(binding_sock_);
-        binding_sock_ = kInvalidSocket;
-
-        CloseSocket(sock_);
-        sock_ = kInvalidSocket;
+  // Returns a random delay before answering a query, spread over the time
+  // the whole population needs to answer at max_announce_rate, or at
+  // kQueryResponseRate if that is not set. The window is at least
+  // query_response_delay and at most the announce interval, after which the
+  // periodic announcement answers the query instead. Requires mutex_.
+  int64_t queryResponseDelay() {
+    double rate = parameters_.max_announce_rate() > 0 ? parameters_.max_announce_rate() : kQueryResponseRate;
+    auto window_ms = static_cast<int64_t>(static_cast<double>(population()) * 1000.0 / rate);
+    window_ms = std::max(std::min(window_ms, adaptiveInterval()), parameters_.query_response_delay_ms());
+    return std::uniform_int_distribution<int64_t>(0, window_ms)(response_gen_);
+  }
 
-        std::cerr << "discovery::Peer can't bind socket." << std::endl;
-        return false;
-      }
+  void sendDatagram(const std::string& data) {
+    size_t failed = transport_->Send(data);
+    packets_sent_.fetch_add(transport_->destination_count() - failed, std::memory_order_relaxed);
+    send_failures_.fetch_add(failed, std::memory_order_relaxed);
+  }
 
-      // TODO(sunwenqi): Replace timeout-based unblocking with a pipe/eventfd
-      // so that shutdown latency is not bounded by the 1-second timeout.
-      SetSocketTimeout(binding_sock_, SO_RCVTIMEO, 1000);
+  // Broadcasts a packet that is not an announcement of this peer.
+  void sendControlPacket(PacketType packet_type, const std::string& payload) {
+    Packet packet;
+    packet.set_packet_type(packet_type);
+    packet.set_flags(kPacketFlagExtensionsAware);
+    packet.set_application_id(parameters_.application_id());
+    packet.set_peer_id(peer_id_);
+    packet.set_user_data(payload);
+    std::string data;
+    if (packet.Serialize(data)) {
+      sendDatagram(data);
     }
-
-    return true;
   }
 
-  void SetUserData(const std::string& user_data) override {
-    std::lock_guard<std::mutex> lock(mutex_);
-    user_data_ = user_data;
+  // Broadcasts a request for the full user data of each peer in requests,
+  // then clears it.
+  void sendUserDataRequests(std::vector<uint32_t>* requests) {
+    for (uint32_t requested_peer_id : *requests) {
+      sendControlPacket(kPacketUserDataRequest, MakeUserDataRequestPayload(requested_peer_id));
+    }
+    requests->clear();
   }
 
-  std::list<DiscoveredPeer> ListDiscovered() override {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return discovered_peers_;
+  // Returns true if announcements may rely on the protocol extensions: this
+  // peer listens, so it would hear peers that predate them, and none was
+  // heard within the TTL. Requires mutex_.
+  bool extensionsUsable(int64_t cur_time_ms) const {
+    if (!parameters_.can_discover()) {
+      return false;
+    }
+    return !legacy_peer_heard_ || cur_time_ms - legacy_peer_heard_ms_ > parameters_.discovered_peer_ttl_ms();
   }
 
-  void Exit() override {
-    std::lock_guard<std::mutex> lock(mutex_);
-    exit_ = true;
+  // Returns true if the next announcement may be a digest-only heartbeat.
+  // Requires mutex_.
+  bool canSendHeartbeat(int64_t cur_time_ms) const {
+    return parameters_.use_heartbeats() && !full_announcement_pending_ && extensionsUsable(cur_time_ms);
   }
 
-  void SendingThreadFunc() {
-    int64_t last_send_time_ms = 0;
-    int64_t last_delete_idle_ms = 0;
+  // Re-serializes the announcement frames for the current user data. With
+  // compress set, the full announcement carries compressed user data if
+  // that is smaller. Requires mutex_.
+  void buildFrames(bool compress) {
+    Packet packet;
+    packet.set_flags(kPacketFlagExtensionsAware);
+    packet.set_application_id(parameters_.application_id());
+    packet.set_peer_id(peer_id_);
+    packet.set_user_data(MakeHeartbeatPayload(UserDataDigest(user_data_)));
+    heartbeat_frame_.clear();
+    if (!packet.Serialize(heartbeat_frame_)) {
+      heartbeat_frame_.clear();
+    }
 
-    while (true) {
-      bool should_exit = false;
-      {
-        std::lock_guard<std::mutex> lock(mutex_);
-        should_exit = exit_;
-      }
+    frame_compressed_ = compress;
+    frame_.clear();
+    fragment_frames_.clear();
 
-      if (should_exit) {
-        sendPacket(kPacketIAmOutOfHere);
+    std::string payload;
+    uint8_t payload_flags = kPacketFlagExtensionsAware;
+    if (compress && CompressPayload(user_data_, &payload)) {
+      payload_flags |= kPacketFlagCompressed;
+    } else {
+      payload = user_data_;
+    }
+
+    packet.set_flags(payload_flags);
+    if (payload.size() > kMaxUserDataSize) {
+      // Announce in fragments; frame_ keeps an empty payload for
+      // kIAmOutOfHere. User data too large even for fragments is not
+      // announced at all.
+      if (!SerializeFragments(packet, payload, &fragment_frames_)) {
+        heartbeat_frame_.clear();
         return;
       }
+      packet.set_flags(kPacketFlagExtensionsAware);
+      payload.clear();
+    }
 
-      int64_t cur_time_ms = NowTime();
-      int64_t to_sleep_ms = std::numeric_limits<int64_t>::max();
+    packet.SwapUserData(payload);
+    if (!packet.Serialize(frame_)) {
+      frame_.clear();
+    }
+  }
 
-      if (parameters_.can_be_discovered()) {
-        int64_t next_send_wait = 0;
-        if (IsRightTime(last_send_time_ms, cur_time_ms, parameters_.send_timeout_ms(), next_send_wait)) {
-          sendPacket(kPacketIAmHere);
-          last_send_time_ms = cur_time_ms;
-        }
-        to_sleep_ms = next_send_wait;
+  // Sends the cached announcement frame, re-serializing it only when the
+  // user data or the use of compression has changed since the previous
+  // send. A kIAmHere announcement goes out as a kHeartbeat whenever
+  // canSendHeartbeat() allows it.
+  void sendPacket(PacketType packet_type, int64_t cur_time_ms) {
+    uint64_t packet_idx;
+    bool heartbeat = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      packet_idx = packet_index_++;
+      bool compress = parameters_.use_compression() && user_data_.size() >= parameters_.compression_threshold() &&
+                      extensionsUsable(cur_time_ms);
+      if (frame_dirty_ || compress != frame_compressed_) {
+        frame_dirty_ = false;
+        buildFrames(compress);
       }
-
-      if (parameters_.can_discover()) {
-        int64_t next_idle_wait = 0;
-        if (IsRightTime(last_delete_idle_ms, cur_time_ms, parameters_.discovered_peer_ttl_ms(), next_idle_wait)) {
-          deleteIdle(cur_time_ms);
-          last_delete_idle_ms = cur_time_ms;
+      if (packet_type == kPacketIAmHere) {
+        heartbeat = canSendHeartbeat(cur_time_ms);
+        if (!heartbeat) {
+          full_announcement_pending_ = false;
+          ++full_announcements_sent_;
         }
-        to_sleep_ms = std::min(to_sleep_ms, next_idle_wait);
       }
+    }
 
-      if (to_sleep_ms > 0 && to_sleep_ms != std::numeric_limits<int64_t>::max()) {
-        SleepFor(std::chrono::milliseconds(to_sleep_ms));
+    if (packet_type == kPacketIAmHere && !heartbeat && !fragment_frames_.empty()) {
+      for (auto& fragment : fragment_frames_) {
+        if (impl::PatchPacketHeader(&fragment, kPacketIAmHereFragment, packet_idx)) {
+          sendDatagram(fragment);
+        }
       }
+      return;
     }
-  }
 
-  void ReceivingThreadFunc() {
-    std::string buffer(kMaxPacketSize, '\0');
+    std::string& frame = heartbeat ? heartbeat_frame_ : frame_;
+    if (!impl::PatchPacketHeader(&frame, heartbeat ? kPacketHeartbeat : packet_type, packet_idx)) {
+      return;
+    }
 
-    while (true) {
-      sockaddr_in from_addr{};
-      AddressLenType addr_length = sizeof(sockaddr_in);
+    sendDatagram(frame);
+  }
 
-      auto length = recvfrom(binding_sock_, &buffer[0], static_cast<int>(kMaxPacketSize), 0,
-                             reinterpret_cast<sockaddr*>(&from_addr), &addr_length);
+  PeerParameters parameters_;
+  uint32_t peer_id_ = 0;
+  SocketType binding_sock_ = kInvalidSocket;
+  std::unique_ptr<Transport> transport_;
+  uint64_t packet_index_ = 0;
+  // Serialized full announcement and heartbeat, owned by the sending thread.
+  // User data too large for one packet is announced by fragment_frames_,
+  // and frame_ then carries no user data.
+  std::string frame_;
+  std::string heartbeat_frame_;
+  std::vector<std::string> fragment_frames_;
+  int64_t last_send_time_ms_ = 0;
+  // Interval drawn for the current announce period.
+  int64_t send_interval_ms_ = 0;
+  std::mt19937 jitter_gen_;
+  int burst_remaining_ = 0;
+  int64_t burst_interval_ms_ = 0;
+  // Set while a resend waits out min_resend_interval.
+  bool resend_deferred_ = false;
+  // Set until the query announced on start has been sent.
+  bool query_pending_ = false;
+
+  Waker waker_;
+  // Shared with the hosting PeerGroup, if any.
+  std::shared_ptr<PacketDecoder> decoder_;
+  std::function<void()> wake_scheduler_;
+  // Owned by the receiving thread.
+  std::vector<uint32_t> requests_;
+  // Owned by the driver of a driven peer.
+  std::vector<PacketView> receive_packets_;
+  std::vector<IpPort> receive_senders_;
+  std::vector<PacketDecoder::Scratch> receive_scratch_;
+
+  // Counters reported by GetStats() in addition to the decoder's.
+  std::atomic<uint64_t> rejected_self_{0};
+  std::atomic<uint64_t> packets_sent_{0};
+  std::atomic<uint64_t> send_failures_{0};
+  std::atomic<uint64_t> peers_joined_{0};
+  std::atomic<uint64_t> peers_updated_{0};
+  std::atomic<uint64_t> peers_left_{0};
+  std::atomic<uint64_t> peers_expired_{0};
+  std::atomic<uint64_t> table_size_{0};
+  LatencyRecorder lock_hold_time_;
 
-      {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (exit_) {
-          return;
-        }
-      }
+  mutable std::mutex mutex_;
+  std::condition_variable wake_cv_;
+  std::condition_variable finished_cv_;
+  bool exit_ = false;
+  // Set once the departure packet has been sent.
+  bool finished_ = false;
+  bool sender_woken_ = false;
+  bool resend_requested_ = false;
+  // Time the next sending round is due at, or PeerTable::kNoExpiry.
+  int64_t sender_wakeup_ms_ = 0;
+  // When a pending TTL reduction may be applied, or 0.
+  int64_t ttl_shrink_due_ms_ = 0;
+  // When the pending query response is due, or 0 if none is pending.
+  int64_t query_response_due_ms_ = 0;
+  // Draws query response delays and user data request backoffs.
+  std::mt19937 response_gen_;
+  // Requests for the user data of peers whose heartbeats carry an unknown
+  // digest, by peer_id.
+  struct UserDataRequestState {
+    // No request is sent before this time.
+    int64_t next_request_ms = 0;
+    // Backoff applied by the latest request, or 0 before the first.
+    int64_t backoff_ms = 0;
+    // Last time the peer's heartbeat or a request for it was heard.
+    int64_t touched_ms = 0;
+  };
+  std::unordered_map<uint32_t, UserDataRequestState> user_data_requests_;
+  // Time each announcer was last heard, by peer_id, if this peer counts
+  // announcers.
+  std::unordered_map<uint32_t, int64_t> announcers_;
+  // Full announcements sent so far, and the count when the earliest
+  // unanswered query arrived.
+  uint64_t full_announcements_sent_ = 0;
+  uint64_t full_announcements_at_query_ = 0;
+  std::string user_data_;
+  bool frame_dirty_ = true;
+  // Whether frame_ was built with compression allowed.
+  bool frame_compressed_ = false;
+  // Set until the current user data has been announced in full.
+  bool full_announcement_pending_ = true;
+  // Whether and when a full announcement without kPacketFlagExtensionsAware
+  // was last received.
+  bool legacy_peer_heard_ = false;
+  int64_t legacy_peer_heard_ms_ = 0;
+  std::vector<std::shared_ptr<PeerSubscription>> subscriptions_;
+  bool snapshot_dirty_ = false;
+  ChangeLog change_log_;
+
+  // Published with std::atomic_store so Snapshot() never takes mutex_.
+  DiscoveredPeersSnapshot snapshot_ = std::make_shared<const std::vector<DiscoveredPeer>>();
+  PeerTable discovered_peers_;
+};
 
-      if (length <= 0) {
-        continue;
-      }
+std::shared_ptr<DrivenPeer> StartDrivenPeer(const PeerParameters& parameters, const std::string& user_data,
+                                            std::unique_ptr<Transport> transport, uint32_t seed) {
+  auto env = std::make_shared<PeerEnv>();
+  if (!env->StartDriven(parameters, user_data, std::move(transport), seed)) {
+    return nullptr;
+  }
+  return env;
+}
 
-      IpPort from;
-      from.set_port(ntohs(from_addr.sin_port));
-      from.set_ip(ntohl(from_addr.sin_addr.s_addr));
+// Hosts many PeerEnvs on one receiving socket and one scheduling thread.
+// Every datagram is decoded once and delivered to the members listening for
+// its application_id.
+class PeerGroupEnv {
+ public:
+  PeerGroupEnv() = default;
 
-      std::string received(buffer.data(), static_cast<size_t>(length));
-      processReceivedBuffer(NowTime(), from, received);
+  ~PeerGroupEnv() {
+    if (binding_sock_ != kInvalidSocket) {
+      CloseSocket(binding_sock_);
     }
   }
 
- private:
-  void processReceivedBuffer(int64_t cur_time_ms, const IpPort& from, const std::string& buffer) {
-    Packet packet;
-    if (!packet.Parse(buffer)) {
-      return;
+  PeerGroupEnv(const PeerGroupEnv&) = delete;             // Non-copyable.
+  PeerGroupEnv& operator=(const PeerGroupEnv&) = delete;  // Non-copyable.
+
+  bool Start(const PeerParameters& parameters) {
+    parameters_ = parameters;
+    InitSockets();
+
+    binding_sock_ = OpenBindingSocket(parameters_);
+    if (binding_sock_ == kInvalidSocket) {
+      return false;
+    }
+#if defined(__linux__)
+    // Members may come and go with any application_id, so only the header
+    // is checked.
+    if (parameters_.use_socket_filter() && !AttachPacketFilter(binding_sock_, true, 0)) {
+      ReportError("discovery::PeerGroup failed to attach socket filter.");
     }
+#endif
+
+    if (!waker_.Open()) {
+      CloseSocket(binding_sock_);
+      binding_sock_ = kInvalidSocket;
 
-    bool accept_packet = (parameters_.application_id() == packet.application_id()) &&
-                         (parameters_.discover_self() || packet.peer_id() != peer_id_);
+      ReportError("discovery::PeerGroup can't create wakeup handle.");
+      return false;
+    }
+    return true;
+  }
 
-    if (accept_packet) {
-      std::lock_guard<std::mutex> lock(mutex_);
+  const std::shared_ptr<PacketDecoder>& decoder() const { return decoder_; }
 
-      auto find_it =
-          std::find_if(discovered_peers_.begin(), discovered_peers_.end(), [this, &from](const DiscoveredPeer& peer) {
-            return Same(parameters_.same_peer_mode(), peer.ip_port(), from);
-          });
-
-      if (packet.packet_type() == kPacketIAmHere) {
-        if (find_it == discovered_peers_.end()) {
-          discovered_peers_.emplace_back();
-          discovered_peers_.back().set_ip_port(from);
-          discovered_peers_.back().SetUserData(packet.user_data(), packet.snapshot_index());
-          discovered_peers_.back().set_last_updated(cur_time_ms);
-        } else {
-          if (find_it->last_received_packet() < packet.snapshot_index()) {
-            find_it->SetUserData(packet.user_data(), packet.snapshot_index());
-          }
-          find_it->set_last_updated(cur_time_ms);
-        }
-      } else if (packet.packet_type() == kPacketIAmOutOfHere) {
-        if (find_it != discovered_peers_.end()) {
-          discovered_peers_.erase(find_it);
-        }
-      }
+  // Returns true if a peer started with parameters can be hosted: it must
+  // listen on the group's port and, if it uses multicast, on its group.
+  bool Accepts(const PeerParameters& parameters) const {
+    if (parameters.port() != parameters_.port()) {
+      return false;
+    }
+    if (parameters.can_use_multicast() && (!parameters_.can_use_multicast() || parameters.multicast_group_address() !=
+                                                                                   parameters_.multicast_group_address())) {
+      return false;
     }
+    return true;
   }
 
-  void deleteIdle(int64_t cur_time_ms) {
+  // Adds a started peer. Returns false if the group has exited.
+  bool Attach(const std::shared_ptr<PeerEnv>& peer) {
     std::lock_guard<std::mutex> lock(mutex_);
+    if (exit_) {
+      return false;
+    }
+    members_.push_back(peer);
+    publishRoutes();
+    wakeScheduler();
+    return true;
+  }
 
-    discovered_peers_.remove_if([this, cur_time_ms](const DiscoveredPeer& peer) {
-      return cur_time_ms - peer.last_updated() > parameters_.discovered_peer_ttl_ms();
-    });
+  // Makes the scheduling thread re-check every member.
+  void Wake() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    wakeScheduler();
   }
 
-  void sendPacket(PacketType packet_type) {
-    std::string user_data;
-    uint64_t packet_idx;
+  // Stops every member; the threads finish once all of them have sent their
+  // departure packets.
+  void Exit() {
+    std::vector<std::shared_ptr<PeerEnv>> members;
     {
       std::lock_guard<std::mutex> lock(mutex_);
-      user_data = user_data_;
-      packet_idx = packet_index_++;
+      exit_ = true;
+      members = members_;
+      wakeScheduler();
     }
+    // Members call Wake() from Exit(), so mutex_ must not be held here.
+    for (const auto& member : members) {
+      member->Exit();
+    }
+    waker_.Signal();
+  }
 
-    Packet packet;
-    packet.set_packet_type(packet_type);
-    packet.set_application_id(parameters_.application_id());
-    packet.set_peer_id(peer_id_);
-    packet.set_snapshot_index(packet_idx);
-    packet.SwapUserData(user_data);
+  PeerStats GetStats() const { return decoder_->Stats(); }
 
-    std::string packet_data;
-    if (!packet.Serialize(packet_data)) {
-      return;
-    }
+  void SchedulingThreadFunc() {
+    std::vector<std::shared_ptr<PeerEnv>> members;
+    std::vector<PeerEnv*> finished;
+
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        scheduler_woken_ = false;
+        members = members_;
+      }
 
-    if (parameters_.can_use_broadcast()) {
-      sockaddr_in addr{};
-      addr.sin_family = AF_INET;
-      addr.sin_port = htons(parameters_.port());
-      addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
-      if (sendto(sock_, packet_data.data(), static_cast<int>(packet_data.size()), 0,
-                 reinterpret_cast<sockaddr*>(&addr), sizeof(sockaddr_in)) < 0) {
-        std::cerr << "discovery::Peer failed to send broadcast packet." << std::endl;
+      int64_t cur_time_ms = NowTime();
+      int64_t wakeup_ms = PeerTable::kNoExpiry;
+      finished.clear();
+      for (const auto& member : members) {
+        if (member->SendingWakeup() <= cur_time_ms && !member->RunSendingRound(cur_time_ms)) {
+          finished.push_back(member.get());
+          continue;
+        }
+        wakeup_ms = std::min(wakeup_ms, member->SendingWakeup());
+      }
+      members.clear();
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (!finished.empty()) {
+        auto detached = std::remove_if(members_.begin(), members_.end(), [&finished](const std::shared_ptr<PeerEnv>& m) {
+          return std::find(finished.begin(), finished.end(), m.get()) != finished.end();
+        });
+        members_.erase(detached, members_.end());
+        publishRoutes();
+      }
+      if (exit_ && members_.empty()) {
+        return;
       }
-    }
 
-    if (parameters_.can_use_multicast()) {
-      sockaddr_in addr{};
-      addr.sin_family = AF_INET;
-      addr.sin_port = htons(parameters_.port());
-      addr.sin_addr.s_addr = htonl(parameters_.multicast_group_address());
-      if (sendto(sock_, packet_data.data(), static_cast<int>(packet_data.size()), 0,
-                 reinterpret_cast<sockaddr*>(&addr), sizeof(sockaddr_in)) < 0) {
-        std::cerr << "discovery::Peer failed to send multicast packet." << std::endl;
+      auto woken = [this]() { return scheduler_woken_; };
+      if (wakeup_ms == PeerTable::kNoExpiry) {
+        wake_cv_.wait(lock, woken);
+      } else {
+        int64_t delay_ms = wakeup_ms - NowTime();
+        if (delay_ms > 0) {
+          wake_cv_.wait_for(lock, std::chrono::milliseconds(delay_ms), woken);
+        }
       }
     }
   }
 
+  void ReceivingThreadFunc() {
+    std::vector<PeerEnv*> recipients;
+    ReceiveLoop(binding_sock_, waker_, *decoder_,
+                [this, &recipients](int64_t cur_time_ms, const IpPort* senders, const PacketView* packets, size_t count) {
+                  // Each member takes the whole batch and skips the packets of
+                  // other applications.
+                  auto routes = std::atomic_load(&routes_);
+                  recipients.clear();
+                  for (size_t i = 0; i < count; ++i) {
+                    auto route = routes->find(packets[i].application_id());
+                    if (route == routes->end()) {
+                      decoder_->CountForeignApplication();
+                      continue;
+                    }
+                    for (const auto& member : route->second) {
+                      if (std::find(recipients.begin(), recipients.end(), member.get()) == recipients.end()) {
+                        recipients.push_back(member.get());
+                      }
+                    }
+                  }
+                  for (PeerEnv* member : recipients) {
+                    member->Deliver(cur_time_ms, senders, packets, count);
+                  }
+                  return true;
+                });
+  }
+
+ private:
+  // Members by application_id.
+  using Routes = std::unordered_map<uint32_t, std::vector<std::shared_ptr<PeerEnv>>>;
+
+  // Replaces the routes read by the receiving thread. Requires mutex_.
+  void publishRoutes() {
+    auto routes = std::make_shared<Routes>();
+    for (const auto& member : members_) {
+      (*routes)[member->parameters().application_id()].push_back(member);
+    }
+    std::atomic_store(&routes_, std::shared_ptr<const Routes>(std::move(routes)));
+  }
+
+  // Requires mutex_.
+  void wakeScheduler() {
+    scheduler_woken_ = true;
+    wake_cv_.notify_one();
+  }
+
   PeerParameters parameters_;
-  uint32_t peer_id_ = 0;
   SocketType binding_sock_ = kInvalidSocket;
-  SocketType sock_ = kInvalidSocket;
-  uint64_t packet_index_ = 0;
+  Waker waker_;
+  std::shared_ptr<PacketDecoder> decoder_ = std::make_shared<PacketDecoder>();
 
-  mutable std::mutex mutex_;
+  std::mutex mutex_;
+  std::condition_variable wake_cv_;
   bool exit_ = false;
-  std::string user_data_;
-  std::list<DiscoveredPeer> discovered_peers_;
+  bool scheduler_woken_ = false;
+  std::vector<std::shared_ptr<PeerEnv>> members_;
+
+  // Published with std::atomic_store so delivery never takes mutex_.
+  std::shared_ptr<const Routes> routes_ = std::make_shared<const Routes>();
 };
 
 }  // namespace impl
@@ -416,13 +1790,45 @@ bool Peer::Start(const PeerParameters& parameters, const std::string& user_data)
   // Capture env by value so the threads keep it alive beyond Peer's lifetime.
   sending_thread_ = std::make_unique<std::thread>([env]() { env->SendingThreadFunc(); });
 
-  if (parameters.can_discover()) {
+  if (impl::ReceivesDatagrams(parameters)) {
     receiving_thread_ = std::make_unique<std::thread>([env]() { env->ReceivingThreadFunc(); });
   }
 
   return true;
 }
 
+bool Peer::Start(PeerGroup& group, const PeerParameters& parameters, const std::string& user_data) {
+  StopImpl(false);
+
+  std::shared_ptr<impl::PeerGroupEnv> group_env = group.env_;
+  if (!group_env) {
+    impl::ReportError("discovery::Peer can't join a PeerGroup that is not started.");
+    return false;
+  }
+  if (!group_env->Accepts(parameters)) {
+    impl::ReportError("discovery::Peer parameters don't match the PeerGroup's port or multicast group.");
+    return false;
+  }
+
+  // The group outlives its members only as long as someone holds it.
+  std::weak_ptr<impl::PeerGroupEnv> weak_group = group_env;
+  auto env = std::make_shared<impl::PeerEnv>();
+  if (!env->StartInGroup(parameters, user_data, group_env->decoder(), [weak_group]() {
+        if (auto locked = weak_group.lock()) {
+          locked->Wake();
+        }
+      })) {
+    return false;
+  }
+  if (!group_env->Attach(env)) {
+    impl::ReportError("discovery::Peer can't join a PeerGroup that is stopping.");
+    return false;
+  }
+
+  env_ = env;
+  return true;
+}
+
 void Peer::SetUserData(const std::string& user_data) {
   if (env_) {
     env_->SetUserData(user_data);
@@ -436,6 +1842,38 @@ std::list<DiscoveredPeer> Peer::ListDiscovered() const {
   return {};
 }
 
+std::shared_ptr<PeerSubscription> Peer::Subscribe(size_t max_queued_events) {
+  if (env_) {
+    return env_->Subscribe(max_queued_events);
+  }
+  return nullptr;
+}
+
+DiscoveredPeersSnapshot Peer::Snapshot() const {
+  if (env_) {
+    return env_->Snapshot();
+  }
+  static const DiscoveredPeersSnapshot kEmpty = std::make_shared<const std::vector<DiscoveredPeer>>();
+  return kEmpty;
+}
+
+PeerChanges Peer::ChangesSince(uint64_t generation) const {
+  if (env_) {
+    return env_->ChangesSince(generation);
+  }
+  // Nothing to account for; the caller's mirror has to be discarded.
+  PeerChanges changes;
+  changes.set_full_resync(true);
+  return changes;
+}
+
+PeerStats Peer::GetStats() const {
+  if (env_) {
+    return env_->GetStats();
+  }
+  return {};
+}
+
 void Peer::Stop() { StopImpl(false); }
 
 void Peer::StopAndWaitForThreads() { StopImpl(true); }
@@ -448,6 +1886,10 @@ void Peer::StopImpl(bool wait_for_threads) {
   }
 
   env_->Exit();
+  // A peer hosted by a PeerGroup has no threads of its own.
+  if (wait_for_threads && !sending_thread_) {
+    env_->WaitForExit();
+  }
   env_.reset();
 
   if (sending_thread_ && sending_thread_->joinable()) {
@@ -469,6 +1911,65 @@ void Peer::StopImpl(bool wait_for_threads) {
   receiving_thread_.reset();
 }
 
+PeerGroup::PeerGroup() = default;
+
+PeerGroup::~PeerGroup() { StopImpl(false); }
+
+bool PeerGroup::Start(const PeerParameters& parameters) {
+  StopImpl(false);
+
+  auto env = std::make_shared<impl::PeerGroupEnv>();
+  if (!env->Start(parameters)) {
+    return false;
+  }
+
+  env_ = env;
+
+  // Capture env by value so the threads keep it alive beyond PeerGroup's
+  // lifetime.
+  scheduling_thread_ = std::make_unique<std::thread>([env]() { env->SchedulingThreadFunc(); });
+  receiving_thread_ = std::make_unique<std::thread>([env]() { env->ReceivingThreadFunc(); });
+  return true;
+}
+
+PeerStats PeerGroup::GetStats() const {
+  if (env_) {
+    return env_->GetStats();
+  }
+  return {};
+}
+
+void PeerGroup::Stop() { StopImpl(false); }
+
+void PeerGroup::StopAndWaitForThreads() { StopImpl(true); }
+
+void PeerGroup::StopImpl(bool wait_for_threads) {
+  if (!env_) {
+    return;
+  }
+
+  env_->Exit();
+  env_.reset();
+
+  if (scheduling_thread_ && scheduling_thread_->joinable()) {
+    if (wait_for_threads) {
+      scheduling_thread_->join();
+    } else {
+      scheduling_thread_->detach();
+    }
+  }
+  if (receiving_thread_ && receiving_thread_->joinable()) {
+    if (wait_for_threads) {
+      receiving_thread_->join();
+    } else {
+      receiving_thread_->detach();
+    }
+  }
+
+  scheduling_thread_.reset();
+  receiving_thread_.reset();
+}
+
 bool Same(PeerParameters::SamePeerMode mode, const IpPort& lhv, const IpPort& rhv) {
   switch (mode) {
     case PeerParameters::SamePeerMode::kIp:
@@ -483,27 +1984,22 @@ bool Same(PeerParameters::SamePeerMode mode, const IpPort& lhv, const IpPort& rh
 
 bool Same(PeerParameters::SamePeerMode mode, const std::list<DiscoveredPeer>& lhv,
           const std::list<DiscoveredPeer>& rhv) {
-  for (const auto& lhv_peer : lhv) {
-    auto in_rhv = std::find_if(rhv.begin(), rhv.end(), [mode, &lhv_peer](const DiscoveredPeer& rhv_peer) {
-      return Same(mode, lhv_peer.ip_port(), rhv_peer.ip_port());
-    });
-
-    if (in_rhv == rhv.end()) {
-      return false;
-    }
-  }
+  return SamePeers(mode, lhv, rhv);
+}
 
-  for (const auto& rhv_peer : rhv) {
-    auto in_lhv = std::find_if(lhv.begin(), lhv.end(), [mode, &rhv_peer](const DiscoveredPeer& lhv_peer) {
-      return Same(mode, rhv_peer.ip_port(), lhv_peer.ip_port());
-    });
+bool Same(PeerParameters::SamePeerMode mode, const std::vector<DiscoveredPeer>& lhv,
+          const std::vector<DiscoveredPeer>& rhv) {
+  return SamePeers(mode, lhv, rhv);
+}
 
-    if (in_lhv == lhv.end()) {
-      return false;
-    }
-  }
+PeerChanges Diff(PeerParameters::SamePeerMode mode, const std::list<DiscoveredPeer>& before,
+                 const std::list<DiscoveredPeer>& after) {
+  return DiffPeers(mode, before, after);
+}
 
-  return true;
+PeerChanges Diff(PeerParameters::SamePeerMode mode, const std::vector<DiscoveredPeer>& before,
+                 const std::vector<DiscoveredPeer>& after) {
+  return DiffPeers(mode, before, after);
 }
 
 }  // namespace discovery
@@ -0,0 +1,60 @@
+#include "discovery/discovery_peer_events.h"
+
+#include <iterator>
+
+namespace discovery {
+
+PeerSubscription::PeerSubscription(size_t max_queued_events) : max_queued_events_(max_queued_events) {}
+
+bool PeerSubscription::WaitEvents(std::vector<PeerEvent>& events_out, std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait_for(lock, timeout, [this]() { return closed_ || overflowed_ || !events_.empty(); });
+  return drainLocked(events_out);
+}
+
+bool PeerSubscription::TryGetEvents(std::vector<PeerEvent>& events_out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return drainLocked(events_out);
+}
+
+void PeerSubscription::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  cv_.notify_all();
+}
+
+bool PeerSubscription::closed() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return closed_;
+}
+
+void PeerSubscription::Push(PeerEventType type, const DiscoveredPeer& peer) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+      return;
+    }
+    if (events_.size() >= max_queued_events_) {
+      overflowed_ = true;
+      return;
+    }
+    events_.emplace_back(type, peer);
+  }
+  cv_.notify_one();
+}
+
+bool PeerSubscription::drainLocked(std::vector<PeerEvent>& events_out) {
+  bool had_events = !events_.empty() || overflowed_;
+  events_out.insert(events_out.end(), std::make_move_iterator(events_.begin()),
+                    std::make_move_iterator(events_.end()));
+  events_.clear();
+  if (overflowed_) {
+    events_out.emplace_back(PeerEventType::kOverflow, DiscoveredPeer());
+    overflowed_ = false;
+  }
+  return had_events || !closed_;
+}
+
+}  // namespace discovery
@@ -0,0 +1,200 @@
+#include "discovery_peer_table.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+constexpr size_t kMinBucketCount = 16;
+
+// Finalizer from SplitMix64; spreads addresses that differ only in their low
+// octets or ports across the whole index.
+uint64_t MixKey(uint64_t key) {
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+  return key;
+}
+
+}  // namespace
+
+namespace discovery {
+namespace impl {
+
+PeerTable::PeerTable(PeerParameters::SamePeerMode mode, int64_t ttl_ms) : mode_(mode), ttl_ms_(ttl_ms) {
+  rehash(kMinBucketCount);
+}
+
+DiscoveredPeer* PeerTable::Find(const IpPort& ip_port) {
+  size_t bucket = findBucket(KeyOf(ip_port));
+  if (bucket == buckets_.size()) {
+    return nullptr;
+  }
+  return &peers_[buckets_[bucket].slot - 1];
+}
+
+DiscoveredPeer& PeerTable::Insert(const IpPort& ip_port, int64_t cur_time_ms) {
+  // Keep the load factor at or below one half so probe sequences stay short.
+  if ((peers_.size() + 1) * 2 > buckets_.size()) {
+    rehash(buckets_.size() * 2);
+  }
+
+  uint64_t key = KeyOf(ip_port);
+  size_t bucket = homeOf(key);
+  while (buckets_[bucket].slot != kEmptyBucket) {
+    bucket = (bucket + 1) & mask_;
+  }
+
+  peers_.emplace_back();
+  peers_.back().set_ip_port(ip_port);
+  peers_.back().set_last_updated(cur_time_ms);
+  deadlines_.push_back(0);
+  buckets_[bucket].key = key;
+  buckets_[bucket].slot = static_cast<uint32_t>(peers_.size());
+  pushExpiry(peers_.size() - 1, key);
+  return peers_.back();
+}
+
+bool PeerTable::Erase(const IpPort& ip_port) {
+  size_t bucket = findBucket(KeyOf(ip_port));
+  if (bucket == buckets_.size()) {
+    return false;
+  }
+  eraseSlot(buckets_[bucket].slot - 1);
+  return true;
+}
+
+size_t PeerTable::EraseExpired(int64_t cur_time_ms, const ExpiredCallback& on_expired) {
+  size_t erased = 0;
+  while (!expiry_heap_.empty() && expiry_heap_.front().deadline <= cur_time_ms) {
+    ExpiryNode node = expiry_heap_.front();
+    std::pop_heap(expiry_heap_.begin(), expiry_heap_.end(), std::greater<ExpiryNode>());
+    expiry_heap_.pop_back();
+
+    // Skip nodes left behind by erased or already rescheduled entries.
+    size_t bucket = findBucket(node.key);
+    if (bucket == buckets_.size()) {
+      continue;
+    }
+    size_t slot = buckets_[bucket].slot - 1;
+    if (deadlines_[slot] != node.deadline) {
+      continue;
+    }
+
+    if (cur_time_ms - peers_[slot].last_updated() > ttl_ms_) {
+      if (on_expired) {
+        on_expired(peers_[slot]);
+      }
+      eraseSlot(slot);
+      ++erased;
+    } else {
+      // Refreshed since the node was scheduled; move it to the new deadline.
+      pushExpiry(slot, node.key);
+    }
+  }
+  return erased;
+}
+
+void PeerTable::set_ttl_ms(int64_t ttl_ms) {
+  bool shortened = ttl_ms < ttl_ms_;
+  ttl_ms_ = ttl_ms;
+  if (!shortened) {
+    // Nodes that come due early are rescheduled by EraseExpired().
+    return;
+  }
+  expiry_heap_.clear();
+  for (size_t slot = 0; slot < peers_.size(); ++slot) {
+    pushExpiry(slot, KeyOf(peers_[slot].ip_port()));
+  }
+}
+
+void PeerTable::Clear() {
+  peers_.clear();
+  deadlines_.clear();
+  expiry_heap_.clear();
+  rehash(kMinBucketCount);
+}
+
+std::list<DiscoveredPeer> PeerTable::ToList() const { return std::list<DiscoveredPeer>(peers_.begin(), peers_.end()); }
+
+uint64_t PeerTable::KeyOf(PeerParameters::SamePeerMode mode, const IpPort& ip_port) {
+  if (mode == PeerParameters::SamePeerMode::kIp) {
+    return ip_port.ip();
+  }
+  return (static_cast<uint64_t>(ip_port.ip()) << 16) | ip_port.port();
+}
+
+size_t PeerTable::homeOf(uint64_t key) const { return static_cast<size_t>(MixKey(key)) & mask_; }
+
+size_t PeerTable::findBucket(uint64_t key) const {
+  size_t bucket = homeOf(key);
+  while (buckets_[bucket].slot != kEmptyBucket) {
+    if (buckets_[bucket].key == key) {
+      return bucket;
+    }
+    bucket = (bucket + 1) & mask_;
+  }
+  return buckets_.size();
+}
+
+void PeerTable::eraseSlot(size_t slot) {
+  const DiscoveredPeer& erased = peers_[slot];
+  eraseBucket(findBucket(KeyOf(erased.ip_port())));
+
+  // Move the last entry into the vacated slot and repoint its bucket.
+  size_t last = peers_.size() - 1;
+  if (slot != last) {
+    peers_[slot] = std::move(peers_[last]);
+    deadlines_[slot] = deadlines_[last];
+    buckets_[findBucket(KeyOf(peers_[slot].ip_port()))].slot = static_cast<uint32_t>(slot + 1);
+  }
+  peers_.pop_back();
+  deadlines_.pop_back();
+}
+
+void PeerTable::eraseBucket(size_t bucket) {
+  // Backward-shift deletion: pull later members of the probe run into the
+  // hole so lookups never need tombstones.
+  size_t hole = bucket;
+  size_t next = hole;
+  while (true) {
+    next = (next + 1) & mask_;
+    if (buckets_[next].slot == kEmptyBucket) {
+      break;
+    }
+    size_t home = homeOf(buckets_[next].key);
+    bool movable = (next > hole) ? (home <= hole || home > next) : (home <= hole && home > next);
+    if (movable) {
+      buckets_[hole] = buckets_[next];
+      hole = next;
+    }
+  }
+  buckets_[hole] = Bucket();
+}
+
+void PeerTable::rehash(size_t bucket_count) {
+  buckets_.assign(bucket_count, Bucket());
+  mask_ = bucket_count - 1;
+  for (size_t slot = 0; slot < peers_.size(); ++slot) {
+    uint64_t key = KeyOf(peers_[slot].ip_port());
+    size_t bucket = homeOf(key);
+    while (buckets_[bucket].slot != kEmptyBucket) {
+      bucket = (bucket + 1) & mask_;
+    }
+    buckets_[bucket].key = key;
+    buckets_[bucket].slot = static_cast<uint32_t>(slot + 1);
+  }
+}
+
+void PeerTable::pushExpiry(size_t slot, uint64_t key) {
+  // An entry expires once strictly more than ttl_ms has passed.
+  int64_t deadline = peers_[slot].last_updated() + ttl_ms_ + 1;
+  deadlines_[slot] = deadline;
+  expiry_heap_.push_back(ExpiryNode{deadline, key});
+  std::push_heap(expiry_heap_.begin(), expiry_heap_.end(), std::greater<ExpiryNode>());
+}
+
+}  // namespace impl
+}  // namespace discovery
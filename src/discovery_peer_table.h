@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <list>
+#include <vector>
+
+#include "discovery/discovery_discovered_peer.h"
+#include "discovery/discovery_peer_parameters.h"
+
+namespace discovery {
+namespace impl {
+
+// Table of discovered peers indexed by their identity under a SamePeerMode.
+//
+// Entries are stored contiguously in a vector and located through an
+// open-addressing hash index, so lookup, insertion and removal are O(1) and
+// iteration touches a single dense array. Removal moves the last entry into
+// the vacated slot, therefore entry order is not stable across Erase() and
+// pointers returned by Find()/Insert() are invalidated by any modification.
+//
+// Expiry is driven by a min-heap of deadlines derived from each entry's
+// last_updated(). Refreshing an entry only touches last_updated(); the heap
+// node is rescheduled lazily when it comes due, so EraseExpired() costs time
+// proportional to the nodes that are due rather than to the table size.
+//
+// Not thread-safe; callers serialize access externally.
+class PeerTable {
+ public:
+  static constexpr int64_t kNoExpiry = std::numeric_limits<int64_t>::max();
+
+  explicit PeerTable(PeerParameters::SamePeerMode mode = PeerParameters::SamePeerMode::kIpAndPort,
+                     int64_t ttl_ms = 0);
+
+  PeerParameters::SamePeerMode mode() const { return mode_; }
+  int64_t ttl_ms() const { return ttl_ms_; }
+
+  // Changes the TTL of every entry, counted from its last_updated().
+  void set_ttl_ms(int64_t ttl_ms);
+
+  size_t size() const { return peers_.size(); }
+  bool empty() const { return peers_.empty(); }
+
+  const std::vector<DiscoveredPeer>& peers() const { return peers_; }
+
+  // Returns the identity of ip_port under mode; equal keys denote the same
+  // peer.
+  static uint64_t KeyOf(PeerParameters::SamePeerMode mode, const IpPort& ip_port);
+  uint64_t KeyOf(const IpPort& ip_port) const { return KeyOf(mode_, ip_port); }
+
+  // Returns the entry identified by ip_port, or nullptr if there is none.
+  DiscoveredPeer* Find(const IpPort& ip_port);
+
+  // Adds an entry for ip_port, stamped as updated at cur_time_ms, and returns
+  // it. The caller must ensure that no entry with the same identity exists
+  // (see Find()).
+  DiscoveredPeer& Insert(const IpPort& ip_port, int64_t cur_time_ms);
+
+  // Removes the entry identified by ip_port. Returns false if there is none.
+  bool Erase(const IpPort& ip_port);
+
+  // Called with each entry removed by EraseExpired(), just before removal.
+  using ExpiredCallback = std::function<void(const DiscoveredPeer&)>;
+
+  // Removes every entry that has not been updated for more than ttl_ms as of
+  // cur_time_ms. Returns the number of removed entries.
+  size_t EraseExpired(int64_t cur_time_ms, const ExpiredCallback& on_expired = nullptr);
+
+  // Returns the earliest time at which EraseExpired() may remove an entry,
+  // or kNoExpiry if nothing is scheduled.
+  int64_t NextExpiry() const { return expiry_heap_.empty() ? kNoExpiry : expiry_heap_.front().deadline; }
+
+  void Clear();
+
+  // Returns a copy of all entries in table order.
+  std::list<DiscoveredPeer> ToList() const;
+
+ private:
+  static constexpr uint32_t kEmptyBucket = 0;
+
+  // Expiry heap node; may be stale if its entry was erased or rescheduled.
+  struct ExpiryNode {
+    int64_t deadline = 0;
+    uint64_t key = 0;
+
+    bool operator>(const ExpiryNode& other) const { return deadline > other.deadline; }
+  };
+
+  // Index bucket; slot holds the entry position plus one, or kEmptyBucket.
+  struct Bucket {
+    uint64_t key = 0;
+    uint32_t slot = kEmptyBucket;
+  };
+
+  size_t homeOf(uint64_t key) const;
+  size_t findBucket(uint64_t key) const;
+  void eraseSlot(size_t slot);
+  void eraseBucket(size_t bucket);
+  void rehash(size_t bucket_count);
+  void pushExpiry(size_t slot, uint64_t key);
+
+  PeerParameters::SamePeerMode mode_;
+  int64_t ttl_ms_;
+  std::vector<DiscoveredPeer> peers_;
+  // Deadline of the heap node that currently owns each entry, by slot.
+  std::vector<int64_t> deadlines_;
+  std::vector<ExpiryNode> expiry_heap_;
+  std::vector<Bucket> buckets_;
+  size_t mask_ = 0;
+};
+
+}  // namespace impl
+}  // namespace discovery
@@ -1,5 +1,34 @@
 #include "discovery/discovery_protocol.h"
 
+#include <algorithm>
+#include <cstring>
+
+#include "discovery_compression.h"
+
+namespace {
+
+// Checks that a fragment payload describes a consistent position within a
+// payload of at most kMaxLargeUserDataSize bytes, so that reassembly can
+// place it without further checks.
+bool IsValidFragment(const char* data, size_t size) {
+  using namespace discovery;
+
+  if (size < kFragmentHeaderSize) {
+    return false;
+  }
+  size_t total_size = impl::LoadBigEndian<uint16_t>(data);
+  size_t index = static_cast<uint8_t>(data[2]);
+  size_t count = static_cast<uint8_t>(data[3]);
+  if (total_size == 0 || total_size > kMaxLargeUserDataSize ||
+      count != (total_size + kMaxFragmentDataSize - 1) / kMaxFragmentDataSize || index >= count) {
+    return false;
+  }
+  size_t expected = std::min(kMaxFragmentDataSize, total_size - index * kMaxFragmentDataSize);
+  return size - kFragmentHeaderSize == expected;
+}
+
+}  // namespace
+
 namespace discovery {
 namespace impl {
 
@@ -10,10 +39,7 @@ bool SerializeString(SerializeDirection direction, std::string* value, size_t va
     if (!buffer_view->CanRead(value_size)) {
       return false;
     }
-    value->resize(value_size);
-    for (size_t i = 0; i < value_size; ++i) {
-      (*value)[i] = buffer_view->Read();
-    }
+    value->assign(buffer_view->ReadBytes(value_size), value_size);
   }
   return true;
 }
@@ -23,106 +49,197 @@ PacketType GetPacketType(uint8_t packet_type) {
     return kPacketIAmHere;
   } else if (packet_type == static_cast<uint8_t>(kPacketIAmOutOfHere)) {
     return kPacketIAmOutOfHere;
+  } else if (packet_type == static_cast<uint8_t>(kPacketHeartbeat)) {
+    return kPacketHeartbeat;
+  } else if (packet_type == static_cast<uint8_t>(kPacketUserDataRequest)) {
+    return kPacketUserDataRequest;
+  } else if (packet_type == static_cast<uint8_t>(kPacketIAmHereFragment)) {
+    return kPacketIAmHereFragment;
+  } else if (packet_type == static_cast<uint8_t>(kPacketQuery)) {
+    return kPacketQuery;
   }
   return kPacketTypeUnknown;
 }
 
-}  // namespace impl
-
-bool Packet::Serialize(std::string& buffer_out) {
-  if (user_data_.size() > kMaxUserDataSize) {
-    return false;
-  }
-  impl::BufferView buffer_view(&buffer_out);
-  return SerializeBody(impl::kSerialize, &buffer_view);
+void EncodePacketHeader(const PacketHeader& header, char* data) {
+  std::memcpy(data + kMagicOffset, kPacketMagic, sizeof(kPacketMagic));
+  data[kVersionOffset] = static_cast<char>(kProtocolVersion);
+  data[kFlagsOffset] = static_cast<char>(header.flags);
+  std::memset(data + kReservedOffset, 0, kPacketTypeOffset - kReservedOffset);
+  data[kPacketTypeOffset] = static_cast<char>(header.packet_type);
+  StoreBigEndian(data + kApplicationIdOffset, header.application_id);
+  StoreBigEndian(data + kPeerIdOffset, header.peer_id);
+  StoreBigEndian(data + kSnapshotIndexOffset, header.snapshot_index);
+  StoreBigEndian(data + kUserDataSizeOffset, header.user_data_size);
 }
 
-bool Packet::Parse(const std::string& buffer) {
-  impl::BufferView buffer_view(buffer.data(), buffer.size());
-
-  // Verify the 4-byte magic signature that identifies this protocol.
-  const char kMagic[] = {'D', 'S', 'C', 'V'};
-  for (char expected : kMagic) {
-    uint8_t byte = 0;
-    if (!impl::SerializeUnsignedIntegerBigEndian(impl::kParse, &byte, &buffer_view)) {
-      return false;
-    }
-    if (byte != static_cast<uint8_t>(expected)) {
-      return false;
-    }
+bool DecodePacketHeader(const char* data, size_t size, PacketHeader* header) {
+  if (size < kPacketHeaderSize) {
+    return false;
   }
-
-  // Reject packets from unknown or future protocol versions.
-  constexpr uint8_t kCurrentVersion = 1;
-  uint8_t version = 0;
-  if (!impl::SerializeUnsignedIntegerBigEndian(impl::kParse, &version, &buffer_view)) {
+  if (std::memcmp(data + kMagicOffset, kPacketMagic, sizeof(kPacketMagic)) != 0) {
     return false;
   }
-  if (version != kCurrentVersion) {
+  // Reject packets from unknown or future protocol versions. Unknown flags
+  // and reserved bytes are ignored.
+  if (static_cast<uint8_t>(data[kVersionOffset]) != kProtocolVersion) {
     return false;
   }
 
-  return SerializeBody(impl::kParse, &buffer_view);
+  header->flags = static_cast<uint8_t>(data[kFlagsOffset]);
+  header->packet_type = static_cast<uint8_t>(data[kPacketTypeOffset]);
+  if (GetPacketType(header->packet_type) == kPacketTypeUnknown) {
+    return false;
+  }
+  header->application_id = LoadBigEndian<uint32_t>(data + kApplicationIdOffset);
+  header->peer_id = LoadBigEndian<uint32_t>(data + kPeerIdOffset);
+  header->snapshot_index = LoadBigEndian<uint64_t>(data + kSnapshotIndexOffset);
+  header->user_data_size = LoadBigEndian<uint16_t>(data + kUserDataSizeOffset);
+  return true;
 }
 
-bool Packet::SerializeBody(impl::SerializeDirection direction, impl::BufferView* buffer_view) {
-  if (direction == impl::kSerialize) {
-    buffer_view->push_back('D');
-    buffer_view->push_back('S');
-    buffer_view->push_back('C');
-    buffer_view->push_back('V');
-    uint8_t version = 1;
-    impl::SerializeUnsignedIntegerBigEndian(impl::kSerialize, &version, buffer_view);
+uint64_t UserDataDigest(std::string_view user_data) {
+  uint64_t digest = 0xcbf29ce484222325ULL;
+  for (char c : user_data) {
+    digest ^= static_cast<uint8_t>(c);
+    digest *= 0x100000001b3ULL;
   }
+  return digest;
+}
 
-  // Three reserved bytes follow the version field (reserved for future use).
-  uint8_t reserved = 0;
-  for (int i = 0; i < 3; ++i) {
-    if (!impl::SerializeUnsignedIntegerBigEndian(direction, &reserved, buffer_view)) {
-      return false;
-    }
-  }
+std::string MakeHeartbeatPayload(uint64_t user_data_digest) {
+  std::string payload(kHeartbeatPayloadSize, '\0');
+  StoreBigEndian(&payload[0], user_data_digest);
+  return payload;
+}
 
-  if (!impl::SerializeUnsignedIntegerBigEndian(direction, &packet_type_, buffer_view)) {
+std::string MakeUserDataRequestPayload(uint32_t peer_id) {
+  std::string payload(kUserDataRequestPayloadSize, '\0');
+  StoreBigEndian(&payload[0], peer_id);
+  return payload;
+}
+
+bool SerializeFragments(const Packet& packet, std::string_view payload, std::vector<std::string>* frames) {
+  frames->clear();
+  if (payload.size() > kMaxLargeUserDataSize) {
     return false;
   }
-  if (direction == impl::kParse) {
-    if (impl::GetPacketType(packet_type_) == kPacketTypeUnknown) {
+
+  size_t count = (payload.size() + kMaxFragmentDataSize - 1) / kMaxFragmentDataSize;
+  Packet fragment = packet;
+  fragment.set_packet_type(kPacketIAmHereFragment);
+  std::string fragment_payload;
+  for (size_t index = 0; index < count; ++index) {
+    std::string_view data = payload.substr(index * kMaxFragmentDataSize, kMaxFragmentDataSize);
+    fragment_payload.resize(kFragmentHeaderSize);
+    StoreBigEndian(&fragment_payload[0], static_cast<uint16_t>(payload.size()));
+    fragment_payload[2] = static_cast<char>(index);
+    fragment_payload[3] = static_cast<char>(count);
+    fragment_payload.append(data.data(), data.size());
+    fragment.SwapUserData(fragment_payload);
+
+    frames->emplace_back();
+    if (!fragment.Serialize(frames->back())) {
+      frames->clear();
       return false;
     }
+    fragment.SwapUserData(fragment_payload);
   }
+  return true;
+}
 
-  if (!impl::SerializeUnsignedIntegerBigEndian(direction, &application_id_, buffer_view)) {
+bool PatchPacketHeader(std::string* buffer, PacketType packet_type, uint64_t snapshot_index) {
+  if (buffer->size() < kPacketHeaderSize) {
     return false;
   }
 
-  if (!impl::SerializeUnsignedIntegerBigEndian(direction, &peer_id_, buffer_view)) {
+  (*buffer)[kPacketTypeOffset] = static_cast<char>(packet_type);
+  StoreBigEndian(&(*buffer)[kSnapshotIndexOffset], snapshot_index);
+  return true;
+}
+
+}  // namespace impl
+
+bool Packet::Serialize(std::string& buffer_out) {
+  if (user_data_.size() > kMaxUserDataSize) {
     return false;
   }
 
-  if (!impl::SerializeUnsignedIntegerBigEndian(direction, &snapshot_index_, buffer_view)) {
+  impl::PacketHeader header;
+  header.flags = flags_;
+  header.packet_type = packet_type_;
+  header.application_id = application_id_;
+  header.peer_id = peer_id_;
+  header.snapshot_index = snapshot_index_;
+  header.user_data_size = static_cast<uint16_t>(user_data_.size());
+
+  // Reserve the whole packet once, encode the header in place, then copy the
+  // payload behind it.
+  size_t offset = buffer_out.size();
+  buffer_out.reserve(offset + kPacketHeaderSize + user_data_.size());
+  buffer_out.resize(offset + kPacketHeaderSize);
+  impl::EncodePacketHeader(header, &buffer_out[offset]);
+  buffer_out.append(user_data_);
+  return true;
+}
+
+bool Packet::Parse(const std::string& buffer) { return Parse(buffer.data(), buffer.size()); }
+
+bool Packet::Parse(const char* data, size_t size) {
+  PacketView view;
+  std::string scratch;
+  if (!view.Parse(data, size) || !view.Decompress(&scratch)) {
     return false;
   }
 
-  auto user_data_size = static_cast<uint16_t>(user_data_.size());
-  if (!impl::SerializeUnsignedIntegerBigEndian(direction, &user_data_size, buffer_view)) {
+  flags_ = view.flags();
+  packet_type_ = static_cast<uint8_t>(view.packet_type());
+  application_id_ = view.application_id();
+  peer_id_ = view.peer_id();
+  snapshot_index_ = view.snapshot_index();
+  user_data_.assign(view.user_data().data(), view.user_data().size());
+  return true;
+}
+
+bool PacketView::Parse(const char* data, size_t size) {
+  impl::PacketHeader header;
+  if (!impl::DecodePacketHeader(data, size, &header)) {
     return false;
   }
 
-  if (direction == impl::kParse) {
-    if (user_data_size > kMaxUserDataSize) {
-      return false;
-    }
-    // Ensure the remaining bytes match the declared payload length exactly.
-    if (buffer_view->LeftUnparsed() != user_data_size) {
-      return false;
-    }
+  // Ensure the remaining bytes match the declared payload length exactly.
+  if (header.user_data_size > kMaxUserDataSize || size - kPacketHeaderSize != header.user_data_size) {
+    return false;
   }
 
-  if (!impl::SerializeString(direction, &user_data_, user_data_size, buffer_view)) {
+  // Heartbeats, requests and queries carry fixed-size payloads.
+  packet_type_ = static_cast<PacketType>(header.packet_type);
+  if ((packet_type_ == kPacketHeartbeat && header.user_data_size != kHeartbeatPayloadSize) ||
+      (packet_type_ == kPacketUserDataRequest && header.user_data_size != kUserDataRequestPayloadSize) ||
+      (packet_type_ == kPacketQuery && header.user_data_size != 0)) {
     return false;
   }
+  if (packet_type_ == kPacketIAmHereFragment && !IsValidFragment(data + kPacketHeaderSize, header.user_data_size)) {
+    return false;
+  }
+
+  flags_ = header.flags;
+  application_id_ = header.application_id;
+  peer_id_ = header.peer_id;
+  snapshot_index_ = header.snapshot_index;
+  user_data_ = std::string_view(data + kPacketHeaderSize, header.user_data_size);
+  return true;
+}
 
+bool PacketView::Decompress(std::string* scratch) {
+  if (!compressed()) {
+    return true;
+  }
+  if (!impl::DecompressPayload(user_data_, kMaxLargeUserDataSize, scratch)) {
+    return false;
+  }
+  user_data_ = *scratch;
+  flags_ &= static_cast<uint8_t>(~kPacketFlagCompressed);
   return true;
 }
 
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "discovery/discovery_ip_port.h"
+
+namespace discovery {
+namespace impl {
+
+// Single-producer single-consumer ring of received datagrams between the
+// thread that drains a socket and the thread that decodes and applies them.
+//
+// Every slot has a fixed-size buffer, and consecutive slots are contiguous
+// in memory, so the producer can receive straight into a run of free slots
+// with one recvmmsg() call. Positions are exchanged through two atomics; the
+// only lock is taken by a consumer that found the ring empty and is about to
+// sleep, and by the producer to wake it.
+class ReceiveQueue {
+ public:
+  // capacity is rounded up to a power of two.
+  ReceiveQueue(size_t capacity, size_t slot_size)
+      : capacity_(RoundUpToPowerOfTwo(capacity)),
+        slot_size_(slot_size),
+        buffers_(capacity_ * slot_size),
+        sizes_(capacity_),
+        senders_(capacity_),
+        truncated_(capacity_) {}
+
+  ReceiveQueue(const ReceiveQueue&) = delete;             // Non-copyable.
+  ReceiveQueue& operator=(const ReceiveQueue&) = delete;  // Non-copyable.
+
+  size_t capacity() const { return capacity_; }
+  size_t slot_size() const { return slot_size_; }
+
+  // Producer: returns how many free slots, at most max_count, follow the
+  // write position without wrapping. 0 means the ring is full.
+  size_t BeginWrite(size_t max_count) const {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_acquire);
+    size_t free = capacity_ - static_cast<size_t>(tail - head);
+    size_t until_end = capacity_ - static_cast<size_t>(tail & (capacity_ - 1));
+    return std::min({free, until_end, max_count});
+  }
+
+  // Producer: buffer of the index-th slot past the write position. The
+  // buffers of the slots returned by BeginWrite() are contiguous.
+  char* write_buffer(size_t index) { return &buffers_[slotOf(tail_.load(std::memory_order_relaxed) + index)]; }
+
+  // Producer: describes the datagram stored in the index-th slot.
+  void SetWritten(size_t index, size_t size, const IpPort& from, bool truncated) {
+    size_t slot = static_cast<size_t>((tail_.load(std::memory_order_relaxed) + index) & (capacity_ - 1));
+    sizes_[slot] = size;
+    senders_[slot] = from;
+    truncated_[slot] = truncated;
+  }
+
+  // Producer: hands count written slots to the consumer.
+  void EndWrite(size_t count) {
+    tail_.fetch_add(count, std::memory_order_seq_cst);
+    wakeConsumer();
+  }
+
+  // Producer: no more datagrams will be written; the consumer drains the
+  // ring and then stops.
+  void Close() {
+    closed_.store(true, std::memory_order_seq_cst);
+    wakeConsumer();
+  }
+
+  // Consumer: blocks until datagrams are queued and returns how many, or 0
+  // once the ring is closed and drained.
+  size_t WaitForRead() {
+    size_t count = size();
+    if (count > 0) {
+      return count;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    consumer_waiting_.store(true, std::memory_order_seq_cst);
+    wake_cv_.wait(lock, [this]() { return size() > 0 || closed_.load(std::memory_order_seq_cst); });
+    consumer_waiting_.store(false, std::memory_order_relaxed);
+    return size();
+  }
+
+  // Consumer: the index-th queued datagram.
+  const char* data(size_t index) const { return &buffers_[slotOf(head_.load(std::memory_order_relaxed) + index)]; }
+  size_t size(size_t index) const { return sizes_[readSlot(index)]; }
+  const IpPort& from(size_t index) const { return senders_[readSlot(index)]; }
+  bool truncated(size_t index) const { return truncated_[readSlot(index)]; }
+
+  // Consumer: frees the count oldest slots.
+  void EndRead(size_t count) { head_.fetch_add(count, std::memory_order_release); }
+
+  // Returns the number of queued datagrams.
+  size_t size() const {
+    return static_cast<size_t>(tail_.load(std::memory_order_seq_cst) - head_.load(std::memory_order_relaxed));
+  }
+
+ private:
+  static size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  size_t slotOf(uint64_t position) const { return static_cast<size_t>(position & (capacity_ - 1)) * slot_size_; }
+
+  size_t readSlot(size_t index) const {
+    return static_cast<size_t>((head_.load(std::memory_order_relaxed) + index) & (capacity_ - 1));
+  }
+
+  void wakeConsumer() {
+    if (consumer_waiting_.load(std::memory_order_seq_cst)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wake_cv_.notify_one();
+    }
+  }
+
+  const size_t capacity_;
+  const size_t slot_size_;
+  std::vector<char> buffers_;
+  std::vector<size_t> sizes_;
+  std::vector<IpPort> senders_;
+  std::vector<char> truncated_;
+
+  // Positions only grow; a slot is position % capacity_. head_ is written
+  // by the consumer, tail_ by the producer.
+  alignas(64) std::atomic<uint64_t> head_{0};
+  alignas(64) std::atomic<uint64_t> tail_{0};
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> consumer_waiting_{false};
+  std::mutex mutex_;
+  std::condition_variable wake_cv_;
+};
+
+}  // namespace impl
+}  // namespace discovery
@@ -0,0 +1,180 @@
+#include "discovery_simulated_network.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "discovery_peer_table.h"
+
+namespace discovery {
+namespace impl {
+
+// Hands the datagrams of one peer to the network.
+class SimulatedNetwork::PeerTransport : public Transport {
+ public:
+  PeerTransport(SimulatedNetwork* network, size_t peer) : network_(network), peer_(peer) {}
+
+  size_t Send(const std::string& data) override {
+    network_->broadcast(peer_, data);
+    return 0;
+  }
+
+  size_t destination_count() const override { return 1; }
+
+ private:
+  SimulatedNetwork* network_;
+  size_t peer_;
+};
+
+SimulatedNetwork::SimulatedNetwork(uint32_t seed) : gen_(seed) {}
+
+SimulatedNetwork::~SimulatedNetwork() = default;
+
+void SimulatedNetwork::set_loss_rate(double loss_rate) { loss_rate_ = std::min(std::max(loss_rate, 0.0), 1.0); }
+
+void SimulatedNetwork::set_delay_ms(int64_t min_delay_ms, int64_t max_delay_ms) {
+  min_delay_ms_ = std::max<int64_t>(min_delay_ms, 0);
+  max_delay_ms_ = std::max(max_delay_ms, min_delay_ms_);
+}
+
+size_t SimulatedNetwork::AddPeer(const PeerParameters& parameters, const std::string& user_data) {
+  size_t peer = nodes_.size();
+  auto env = StartDrivenPeer(parameters, user_data, std::make_unique<PeerTransport>(this, peer), gen_());
+  if (!env) {
+    return kNoPeer;
+  }
+
+  Node node;
+  node.env = std::move(env);
+  // 10.x.y.z with a per-peer ephemeral port.
+  node.address = IpPort(0x0a000000u | static_cast<uint32_t>((peer + 1) & 0xffffff),
+                        static_cast<uint16_t>(49152 + peer % 16384));
+  node.port = parameters.port();
+  node.listening = ReceivesDatagrams(parameters);
+  nodes_.push_back(std::move(node));
+  if (nodes_.back().listening) {
+    listeners_.push_back(peer);
+  }
+  scheduleRound(peer);
+  return peer;
+}
+
+void SimulatedNetwork::SetUserData(size_t peer, const std::string& user_data) {
+  if (running(peer)) {
+    nodes_[peer].env->SetUserData(user_data);
+    scheduleRound(peer);
+  }
+}
+
+void SimulatedNetwork::StopPeer(size_t peer) {
+  if (running(peer)) {
+    nodes_[peer].env->Exit();
+    scheduleRound(peer);
+  }
+}
+
+void SimulatedNetwork::CrashPeer(size_t peer) {
+  if (running(peer)) {
+    nodes_[peer].env->Exit();
+    nodes_[peer].env.reset();
+  }
+}
+
+DiscoveredPeersSnapshot SimulatedNetwork::Snapshot(size_t peer) const {
+  if (running(peer)) {
+    return nodes_[peer].env->Snapshot();
+  }
+  return std::make_shared<const std::vector<DiscoveredPeer>>();
+}
+
+PeerStats SimulatedNetwork::GetStats(size_t peer) const {
+  if (running(peer)) {
+    return nodes_[peer].env->GetStats();
+  }
+  return {};
+}
+
+void SimulatedNetwork::RunFor(int64_t duration_ms) {
+  RunUntil([]() { return false; }, duration_ms);
+}
+
+bool SimulatedNetwork::RunUntil(const std::function<bool()>& done, int64_t max_duration_ms) {
+  int64_t deadline_ms = now_ms_ + max_duration_ms;
+  while (!done()) {
+    if (events_.empty() || events_.top().time_ms > deadline_ms) {
+      now_ms_ = deadline_ms;
+      return done();
+    }
+    Event event = events_.top();
+    events_.pop();
+    now_ms_ = event.time_ms;
+    process(event);
+  }
+  return true;
+}
+
+void SimulatedNetwork::broadcast(size_t sender, const std::string& data) {
+  ++datagrams_sent_;
+  auto datagram = std::make_shared<const std::string>(data);
+  std::uniform_real_distribution<double> loss(0.0, 1.0);
+  std::uniform_int_distribution<int64_t> delay(min_delay_ms_, max_delay_ms_);
+  for (size_t listener : listeners_) {
+    if (!running(listener) || nodes_[listener].port != nodes_[sender].port) {
+      continue;
+    }
+    if (loss_rate_ > 0 && loss(gen_) < loss_rate_) {
+      ++datagrams_lost_;
+      continue;
+    }
+    push(now_ms_ + delay(gen_), listener, datagram, nodes_[sender].address);
+  }
+}
+
+void SimulatedNetwork::scheduleRound(size_t peer) {
+  Node& node = nodes_[peer];
+  if (!node.env) {
+    return;
+  }
+  int64_t due_ms = node.env->SendingWakeup();
+  if (due_ms == PeerTable::kNoExpiry) {
+    return;
+  }
+  due_ms = std::max(due_ms, now_ms_);
+  if (due_ms >= node.round_due_ms) {
+    return;
+  }
+  node.round_due_ms = due_ms;
+  push(due_ms, peer, nullptr, IpPort());
+}
+
+void SimulatedNetwork::push(int64_t time_ms, size_t peer, std::shared_ptr<const std::string> datagram,
+                            const IpPort& sender) {
+  events_.push(Event{time_ms, sequence_++, peer, std::move(datagram), sender});
+}
+
+void SimulatedNetwork::process(const Event& event) {
+  Node& node = nodes_[event.peer];
+  if (!node.env) {
+    return;
+  }
+
+  if (event.datagram) {
+    ++datagrams_delivered_;
+    node.env->Receive(now_ms_, event.sender, event.datagram->data(), event.datagram->size());
+    scheduleRound(event.peer);
+    return;
+  }
+
+  // A round moved earlier leaves its original event behind.
+  if (event.time_ms != node.round_due_ms) {
+    return;
+  }
+  node.round_due_ms = kNotScheduled;
+  if (node.env->SendingWakeup() <= now_ms_ && !node.env->RunSendingRound(now_ms_)) {
+    node.env.reset();
+    return;
+  }
+  scheduleRound(event.peer);
+}
+
+}  // namespace impl
+}  // namespace discovery
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "discovery/discovery_ip_port.h"
+#include "discovery/discovery_peer.h"
+#include "discovery/discovery_peer_parameters.h"
+#include "discovery/discovery_peer_stats.h"
+#include "discovery_driven_peer.h"
+
+namespace discovery {
+namespace impl {
+
+// Runs many peers on an in-memory network in virtual time, for scale tests
+// that would otherwise need thousands of sockets and minutes of waiting.
+//
+// Every peer is a DrivenPeer with its own address. A datagram a peer sends
+// reaches every listening peer (see ReceivesDatagrams()) on the same port,
+// each copy lost with loss_rate and delayed by a time drawn uniformly from
+// the delay range, so a non-empty range also reorders datagrams. Time only advances
+// inside RunFor() and RunUntil(), jumping straight to the next sending
+// round or delivery. Given the same seed and calls, every run is identical.
+//
+// Not thread-safe.
+class SimulatedNetwork {
+ public:
+  static constexpr size_t kNoPeer = std::numeric_limits<size_t>::max();
+
+  // Virtual time when the network is created.
+  static constexpr int64_t kStartTimeMs = 1000000;
+
+  explicit SimulatedNetwork(uint32_t seed = 1);
+  ~SimulatedNetwork();
+
+  SimulatedNetwork(const SimulatedNetwork&) = delete;             // Non-copyable.
+  SimulatedNetwork& operator=(const SimulatedNetwork&) = delete;  // Non-copyable.
+
+  // Fraction of datagram copies dropped, clamped to [0, 1]. Default is 0.
+  void set_loss_rate(double loss_rate);
+  double loss_rate() const { return loss_rate_; }
+
+  // Range the delivery delay of every copy is drawn from. Default is 0.
+  void set_delay_ms(int64_t min_delay_ms, int64_t max_delay_ms);
+  int64_t min_delay_ms() const { return min_delay_ms_; }
+  int64_t max_delay_ms() const { return max_delay_ms_; }
+
+  // Starts a peer at the current virtual time. Returns its index, or kNoPeer
+  // if parameters are invalid.
+  size_t AddPeer(const PeerParameters& parameters, const std::string& user_data);
+
+  void SetUserData(size_t peer, const std::string& user_data);
+
+  // Stops a peer; it sends its departure packet in its next sending round.
+  void StopPeer(size_t peer);
+
+  // Removes a peer without a departure packet, as if it crashed or lost its
+  // connection. Peers that knew it only forget it once it expires.
+  void CrashPeer(size_t peer);
+
+  // Returns true until the peer has been crashed or has sent its departure
+  // packet.
+  bool running(size_t peer) const { return nodes_[peer].env != nullptr; }
+
+  // Returns the source address other peers see the peer at.
+  const IpPort& address(size_t peer) const { return nodes_[peer].address; }
+
+  size_t peer_count() const { return nodes_.size(); }
+
+  // Same as Peer::Snapshot() and Peer::GetStats(); empty once the peer is
+  // no longer running.
+  DiscoveredPeersSnapshot Snapshot(size_t peer) const;
+  PeerStats GetStats(size_t peer) const;
+
+  int64_t now_ms() const { return now_ms_; }
+
+  // Advances virtual time by duration_ms.
+  void RunFor(int64_t duration_ms);
+
+  // Advances virtual time until done() returns true, checking it before
+  // every event, or until max_duration_ms has passed. Returns done().
+  bool RunUntil(const std::function<bool()>& done, int64_t max_duration_ms);
+
+  // Datagrams sent, and copies of them delivered and lost.
+  uint64_t datagrams_sent() const { return datagrams_sent_; }
+  uint64_t datagrams_delivered() const { return datagrams_delivered_; }
+  uint64_t datagrams_lost() const { return datagrams_lost_; }
+
+ private:
+  class PeerTransport;
+
+  static constexpr int64_t kNotScheduled = std::numeric_limits<int64_t>::max();
+
+  struct Node {
+    std::shared_ptr<DrivenPeer> env;
+    IpPort address;
+    uint16_t port = 0;
+    bool listening = false;
+    // Time of the pending sending round event, or kNotScheduled.
+    int64_t round_due_ms = kNotScheduled;
+  };
+
+  // A sending round of peer if datagram is null, otherwise the delivery of
+  // datagram from sender to peer.
+  struct Event {
+    int64_t time_ms;
+    uint64_t sequence;
+    size_t peer;
+    std::shared_ptr<const std::string> datagram;
+    IpPort sender;
+
+    bool operator>(const Event& other) const {
+      return time_ms != other.time_ms ? time_ms > other.time_ms : sequence > other.sequence;
+    }
+  };
+
+  // Queues a copy of data sent by sender for every listener on its port.
+  void broadcast(size_t sender, const std::string& data);
+
+  // Queues the peer's next sending round if it is due earlier than the one
+  // already queued.
+  void scheduleRound(size_t peer);
+
+  void push(int64_t time_ms, size_t peer, std::shared_ptr<const std::string> datagram, const IpPort& sender);
+
+  void process(const Event& event);
+
+  std::mt19937 gen_;
+  double loss_rate_ = 0;
+  int64_t min_delay_ms_ = 0;
+  int64_t max_delay_ms_ = 0;
+  int64_t now_ms_ = kStartTimeMs;
+  uint64_t sequence_ = 0;
+  std::vector<Node> nodes_;
+  // Indices of the listening peers, running or not.
+  std::vector<size_t> listeners_;
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+
+  uint64_t datagrams_sent_ = 0;
+  uint64_t datagrams_delivered_ = 0;
+  uint64_t datagrams_lost_ = 0;
+};
+
+}  // namespace impl
+}  // namespace discovery